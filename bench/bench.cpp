@@ -0,0 +1,417 @@
+#include <argparse.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+// Allocation tracking, counts every heap allocation made by the process,
+// including over-aligned ones, which the default pmr resource behind each
+// parser's arena makes. Each block is prefixed with a header which holds its
+// size, so that live and peak bytes can be tracked, and the header's own size.
+
+namespace {
+
+struct AllocStats {
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+    std::size_t peak_bytes = 0;
+};
+AllocStats alloc_stats;
+
+static_assert(alignof(std::max_align_t) >= 2 * sizeof(std::size_t));
+
+void* tracked_alloc(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+    std::size_t header = std::max(alignment, alignof(std::max_align_t));
+    std::size_t total = (size + header + header - 1) / header * header;
+    auto base = static_cast<char*>(std::aligned_alloc(header, total));
+    if (!base) {
+        throw std::bad_alloc();
+    }
+    auto ptr = base + header;
+    reinterpret_cast<std::size_t*>(ptr)[-1] = size;
+    reinterpret_cast<std::size_t*>(ptr)[-2] = header;
+    alloc_stats.count++;
+    alloc_stats.bytes += size;
+    alloc_stats.peak_bytes = std::max(alloc_stats.peak_bytes, alloc_stats.bytes);
+    return ptr;
+}
+
+void tracked_free(void* ptr) {
+    if (!ptr) return;
+    alloc_stats.bytes -= static_cast<std::size_t*>(ptr)[-1];
+    std::free(static_cast<char*>(ptr) - static_cast<std::size_t*>(ptr)[-2]);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) { return tracked_alloc(size); }
+void* operator new[](std::size_t size) { return tracked_alloc(size); }
+void operator delete(void* ptr) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { tracked_free(ptr); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return tracked_alloc(size, std::size_t(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return tracked_alloc(size, std::size_t(alignment)); }
+void operator delete(void* ptr, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { tracked_free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { tracked_free(ptr); }
+
+namespace {
+
+struct Config {
+    std::optional<std::string> filter;
+    double min_seconds;
+    int max_iterations;
+};
+
+// Runs op repeatedly for at least min_seconds (or max_iterations), and writes
+// one JSON object per line with the average cost of each call
+template <typename Op>
+void bench(const Config& config, const std::string& name, Op&& op) {
+    if (config.filter.has_value() && name.find(config.filter.value()) == std::string::npos) {
+        return;
+    }
+
+    // Warm up, so that one-off caching isn't attributed to each call
+    if (!op()) {
+        std::cout << "{\"name\": \"" << name << "\", \"error\": \"parse failed\"}\n";
+        return;
+    }
+
+    using clock_t = std::chrono::steady_clock;
+    AllocStats start_allocs = alloc_stats;
+    alloc_stats.peak_bytes = alloc_stats.bytes;
+
+    std::size_t iterations = 0;
+    auto start = clock_t::now();
+    auto end = start;
+    while (iterations < std::size_t(config.max_iterations)) {
+        if (!op()) {
+            std::cout << "{\"name\": \"" << name << "\", \"error\": \"parse failed\"}\n";
+            return;
+        }
+        iterations++;
+        end = clock_t::now();
+        if (std::chrono::duration<double>(end - start).count() >= config.min_seconds) {
+            break;
+        }
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout
+        << "{\"name\": \"" << name << "\""
+        << ", \"iterations\": " << iterations
+        << ", \"ns_per_op\": " << ns / iterations
+        << ", \"allocs_per_op\": " << double(alloc_stats.count - start_allocs.count) / iterations
+        << ", \"peak_bytes\": " << alloc_stats.peak_bytes - start_allocs.bytes
+        << "}" << std::endl;
+}
+
+// Owns the words for a synthetic command line
+struct CommandLine {
+    std::vector<std::string> words;
+    std::vector<const char*> argv;
+
+    void add(const std::string& word) {
+        words.push_back(word);
+    }
+    void finish() {
+        argv.clear();
+        for (const auto& word: words) {
+            argv.push_back(word.c_str());
+        }
+    }
+    int argc() const {
+        return argv.size();
+    }
+    const char** data() {
+        return argv.data();
+    }
+};
+
+// Silences help and error output
+const argparse::ParseOptions quiet = []() {
+    argparse::ParseOptions options;
+    options.output = [](std::string_view) {};
+    return options;
+}();
+
+constexpr std::size_t num_flags = 1000;
+
+// The flags of bench_flags, as the members of an ArgsParser's args
+struct FlagArgs: public argparse::Args {
+    std::array<int, num_flags> values;
+private:
+    void build(argparse::Parser& parser) override {
+        for (std::size_t i = 0; i < num_flags; i++) {
+            parser.add(values[i], "--flag" + std::to_string(i)).default_value(0);
+        }
+    }
+};
+
+void bench_flags(const Config& config) {
+    bench(config, "build/flags_1k", [&]() {
+        std::vector<int> values(num_flags);
+        argparse::Parser parser;
+        for (std::size_t i = 0; i < num_flags; i++) {
+            parser.add(values[i], "--flag" + std::to_string(i)).default_value(0);
+        }
+        return true;
+    });
+
+    std::vector<int> values(num_flags);
+    argparse::Parser parser;
+    for (std::size_t i = 0; i < num_flags; i++) {
+        parser.add(values[i], "--flag" + std::to_string(i)).default_value(0);
+    }
+    parser.finalize();
+    std::vector<std::uint64_t> scratch(parser.scratch_size());
+    argparse::ParseOptions options = quiet;
+    options.scratch = scratch;
+
+    CommandLine command_line;
+    command_line.add("bench");
+    for (std::size_t i = 0; i < num_flags; i += 10) {
+        command_line.add("--flag" + std::to_string(i));
+        command_line.add(std::to_string(i));
+    }
+    command_line.finish();
+
+    bench(config, "parse/flags_1k", [&]() {
+        return parser.parse(command_line.argc(), command_line.data(), options);
+    });
+
+    // Fingerprints are only computed when parsing into a copy of the
+    // defaults, and only hash the flags given
+    argparse::Fingerprint fingerprint;
+    argparse::ParseOptions fingerprint_options = options;
+    fingerprint_options.fingerprint = &fingerprint;
+    argparse::ArgsParser<FlagArgs> args_parser;
+    args_parser.finalize();
+    FlagArgs args;
+    bench(config, "parse/args_flags_1k", [&]() {
+        return args_parser.parse(command_line.argc(), command_line.data(), args, options);
+    });
+    bench(config, "parse_fingerprint/args_flags_1k", [&]() {
+        return args_parser.parse(command_line.argc(), command_line.data(), args, fingerprint_options);
+    });
+
+    const char* complete_argv[] = { "bench", "__complete", "--", "--flag99" };
+    bench(config, "complete/flags_1k", [&]() {
+        return !parser.parse(4, complete_argv, options);
+    });
+
+    const char* help_argv[] = { "bench", "--help" };
+    bench(config, "help/flags_1k", [&]() {
+        return !parser.parse(2, help_argv, options);
+    });
+
+    // Modifying an item invalidates the cached help, so each parse formats
+    // it again. The parser isn't finalized, so it can be modified.
+    int extra;
+    argparse::Parser uncached_parser;
+    for (std::size_t i = 0; i < num_flags; i++) {
+        uncached_parser.add(values[i], "--flag" + std::to_string(i)).default_value(0);
+    }
+    auto extra_item = uncached_parser.add(extra, "--extra").default_value(0);
+    bench(config, "help_uncached/flags_1k", [&]() {
+        extra_item.help("");
+        return !uncached_parser.parse(2, help_argv, options);
+    });
+}
+
+void bench_lists(const Config& config) {
+    constexpr std::size_t num_words = 1000000;
+
+    CommandLine command_line;
+    command_line.add("bench");
+    for (std::size_t i = 0; i < num_words; i++) {
+        command_line.add("/path/to/some/input/file_" + std::to_string(i) + ".txt");
+    }
+    command_line.finish();
+
+    auto bench_list = [&]<typename T>(const std::string& name, T& output) {
+        argparse::Parser parser;
+        parser.add(output, "files");
+        parser.finalize();
+        bench(config, name, [&]() {
+            return parser.parse(command_line.argc(), command_line.data(), quiet);
+        });
+    };
+
+    std::vector<std::string> strings;
+    bench_list("parse/list_1m/vector_string", strings);
+    strings = {};
+    std::vector<std::string_view> views;
+    bench_list("parse/list_1m/vector_string_view", views);
+    views = {};
+    std::span<const char* const> span;
+    bench_list("parse/list_1m/span", span);
+
+    // Shard IDs and offsets
+    CommandLine numbers;
+    numbers.add("bench");
+    for (std::size_t i = 0; i < num_words; i++) {
+        numbers.add(std::to_string(i * 7919));
+    }
+    numbers.finish();
+
+    auto bench_numbers = [&]<typename T>(const std::string& name, T& output, unsigned threads = 1) {
+        argparse::Parser parser;
+        parser.add(output, "numbers");
+        parser.finalize();
+        argparse::ParseOptions options = quiet;
+        options.list_threads = threads;
+        bench(config, name, [&]() {
+            return parser.parse(numbers.argc(), numbers.data(), options);
+        });
+    };
+
+    std::vector<std::int64_t> int64s;
+    bench_numbers("parse/list_1m/vector_int64", int64s);
+    bench_numbers("parse/list_1m/vector_int64/threads_4", int64s, 4);
+    int64s = {};
+    std::vector<double> doubles;
+    bench_numbers("parse/list_1m/vector_double", doubles);
+    bench_numbers("parse/list_1m/vector_double/threads_4", doubles, 4);
+}
+
+// Parses a command line giving the lists, frees its words, then parses one
+// which doesn't. The lists must be empty afterwards, and the stream must read
+// its input, rather than refer to the freed words, which an address
+// sanitizer build would report reading.
+void bench_reuse(const Config& config) {
+    for (bool finalize: { true, false }) {
+        std::vector<std::string_view> views;
+        std::span<const char* const> span;
+        argparse::ListStream<std::string> stream;
+        bool verbose;
+        argparse::Parser parser;
+        parser.add(views, "--views");
+        parser.add(span, "--span");
+        parser.add(stream, "--stream");
+        parser.add(verbose, "-v");
+        if (finalize) {
+            parser.finalize();
+        }
+
+        const char* without_lists[] = { "bench", "-v" };
+        bench(config, finalize ? "parse/reuse/view_lists" : "parse/reuse/view_lists_unfinalized", [&]() {
+            {
+                CommandLine with_lists;
+                for (const char* word: { "bench", "--views", "a", "b", "--span", "c", "--stream", "d" }) {
+                    with_lists.add(word);
+                }
+                with_lists.finish();
+                bool parsed = parser.parse(with_lists.argc(), with_lists.data(), quiet);
+                if (!parsed || views.size() != 2 || span.size() != 1 || stream.reads_input()) {
+                    return false;
+                }
+            }
+            if (!parser.parse(2, without_lists, quiet)) {
+                return false;
+            }
+            return views.empty() && span.empty() && stream.reads_input();
+        });
+    }
+}
+
+template <int Depth>
+struct Level: public argparse::Args {
+    using Child = Level<Depth - 1>;
+    int value = 0;
+    std::variant<Child> command;
+private:
+    void build(argparse::Parser& parser) override {
+        parser.add(value, "--value").default_value(0);
+        auto subcommand = parser.subcommand(command);
+        for (char c = 'a'; c <= 'z'; c++) {
+            subcommand.template add<Child>(std::string("command_") + c);
+        }
+    }
+};
+
+template <>
+struct Level<0>: public argparse::Args {
+    int value = 0;
+    std::string name;
+private:
+    void build(argparse::Parser& parser) override {
+        parser.add(value, "--value").default_value(0);
+        parser.add(name, "name");
+    }
+};
+
+void bench_subcommands(const Config& config) {
+    const char* argv[] = {
+        "bench",
+        "command_a", "--value", "1",
+        "command_m", "--value", "2",
+        "command_t", "--value", "3",
+        "command_z", "--value", "4",
+        "leaf"
+    };
+    int argc = sizeof(argv) / sizeof(argv[0]);
+
+    bench(config, "build/subcommands_depth4", [&]() {
+        argparse::ArgsParser<Level<4>> parser;
+        Level<4> args;
+        return parser.parse(argc, argv, args, quiet);
+    });
+
+    argparse::ArgsParser<Level<4>> parser;
+    parser.finalize();
+    Level<4> args;
+    bench(config, "parse/subcommands_depth4", [&]() {
+        return parser.parse(argc, argv, args, quiet);
+    });
+}
+
+void bench_choices(const Config& config) {
+    constexpr std::size_t num_choices = 1000;
+
+    std::vector<std::string> choices;
+    for (std::size_t i = 0; i < num_choices; i++) {
+        choices.push_back("region-" + std::to_string(i));
+    }
+
+    std::string region;
+    argparse::Parser parser;
+    parser.add(region, "--region").choices(choices);
+    parser.finalize();
+
+    CommandLine command_line;
+    command_line.add("bench");
+    command_line.add("--region");
+    command_line.add(choices.back());
+    command_line.finish();
+
+    bench(config, "parse/choices_1k", [&]() {
+        return parser.parse(command_line.argc(), command_line.data(), quiet);
+    });
+}
+
+} // namespace
+
+int main(int argc, const char** argv) {
+    Config config;
+    argparse::Parser parser("Benchmarks for parsing, building and help rendering");
+    parser.add(config.filter, "--filter")
+        .help("Only run benchmarks with names containing this");
+    parser.add(config.min_seconds, "--min-seconds")
+        .default_value(0.5)
+        .help("Minimum time to run each benchmark for");
+    parser.add(config.max_iterations, "--max-iterations")
+        .default_value(1000000)
+        .help("Maximum number of iterations of each benchmark");
+    if (!parser.parse(argc, argv)) {
+        return 1;
+    }
+
+    bench_flags(config);
+    bench_lists(config);
+    bench_reuse(config);
+    bench_subcommands(config);
+    bench_choices(config);
+    return 0;
+}
@@ -2,15 +2,23 @@
 
 using T = argparse::Args;
 
+enum class Op {
+    Add,
+    Multiply
+};
+
 struct CliArgs: public argparse::Args {
     int a;
     int b;
-    std::string op;
+    Op op;
 private:
     void build(argparse::Parser& parser) override {
         parser.add(a, "a").help("First argument").default_value(0);
         parser.add(b, "b").help("Second argument").default_value(0);
-        parser.add(op, "--op").help("Operation").choices({"add", "multiply"});
+        parser.add(op, "--op").help("Operation").choices({
+            {"add", Op::Add},
+            {"multiply", Op::Multiply}
+        });
     }
 };
 
@@ -19,15 +27,13 @@ int main(int argc, const char** argv) {
     if (!argparse::parse(argc, argv, args, "Args test")) {
         return 1;
     }
-    if (args.op == "add") {
+    switch (args.op) {
+    case Op::Add:
         std::cout << "Result: " << args.a + args.b << std::endl;
-    }
-    else if (args.op == "multiply") {
+        break;
+    case Op::Multiply:
         std::cout << "Result: " << args.a * args.b << std::endl;
-    }
-    else {
-        assert(false);
-        return 1;
+        break;
     }
     return 0;
 }
@@ -0,0 +1,30 @@
+#include <argparse.hpp>
+
+using Schema = argparse::Schema<"--foo", "-b|--bar", "--count", "a">;
+
+int main(int argc, const char** argv) {
+    std::string foo;
+    std::string bar;
+    std::optional<int> count;
+    int a;
+
+    argparse::Parser parser(Schema{}, "Schema test");
+    parser.add(foo, "--foo")
+        .help("Foo flag");
+    parser.add(bar, "-b|--bar")
+        .default_value("asdf");
+    parser.add(count, "--count");
+    parser.add(a, "a")
+        .help("Argument");
+
+    if (!parser.parse(argc, argv)) {
+        return 1;
+    }
+
+    std::cout << "foo: " << foo << std::endl;
+    std::cout << "bar: " << bar << std::endl;
+    std::cout << "count: " << (count.has_value() ? std::to_string(count.value()) : "<none>") << std::endl;
+    std::cout << "a: " << a << std::endl;
+
+    return 0;
+}
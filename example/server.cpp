@@ -0,0 +1,69 @@
+#include <argparse.hpp>
+
+struct AddCommand: public argparse::Args {
+    int a;
+    int b;
+private:
+    void build(argparse::Parser& parser) override {
+        parser.add(a, "a").help("First argument");
+        parser.add(b, "b").help("Second argument");
+    }
+};
+
+struct NegateCommand: public argparse::Args {
+    int value;
+private:
+    void build(argparse::Parser& parser) override {
+        parser.add(value, "value").help("Argument");
+    }
+};
+
+struct CommandArgs: public argparse::Args {
+    using Command = std::variant<AddCommand, NegateCommand>;
+    Command command;
+private:
+    void build(argparse::Parser& parser) override {
+        parser.subcommand(command)
+            .add<AddCommand>("add", "Add two numbers")
+            .add<NegateCommand>("negate", "Negate a number");
+    }
+};
+
+struct ServerArgs: public argparse::Args {
+    std::optional<std::string> socket;
+private:
+    void build(argparse::Parser& parser) override {
+        parser.add(socket, "--socket").help("Unix socket to listen on, instead of reading stdin");
+    }
+};
+
+// Reads commands such as 'add 1 2' from stdin or a socket, and replies to
+// each with a line of JSON
+int main(int argc, const char** argv) {
+    ServerArgs server_args;
+    if (!argparse::parse(argc, argv, server_args, "Command server")) {
+        return 1;
+    }
+
+    argparse::ArgsParser<CommandArgs> parser;
+    parser.finalize();
+    auto server = argparse::command_server<CommandArgs>(parser, "server",
+        [](const CommandArgs& args, const argparse::Sink& output) {
+            if (auto command = std::get_if<AddCommand>(&args.command)) {
+                output("Result: " + std::to_string(command->a + command->b) + "\n");
+            }
+            if (auto command = std::get_if<NegateCommand>(&args.command)) {
+                output("Result: " + std::to_string(-command->value) + "\n");
+            }
+            return 0;
+        });
+
+    bool ok = server_args.socket.has_value()
+        ? server.listen(server_args.socket.value())
+        : server.serve(0, 1);
+    if (!ok) {
+        std::cerr << server.error() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <argparse.hpp>
+#include <string>
+
+// Prints each file, from argv or else standard input, eg:
+//   find . | example_stream -v
+
+int main(int argc, const char** argv) {
+    argparse::ListStream<std::string> files;
+    bool verbose = false;
+
+    argparse::Parser parser("Stream test");
+    parser.add(files, "files")
+        .help("Files to print, or '-' to read them from standard input");
+    parser.add(verbose, "-v|--verbose")
+        .help("Print the number of files");
+
+    if (!parser.parse(argc, argv)) {
+        return 1;
+    }
+
+    std::size_t count = 0;
+    bool valid = files.read([&](const std::string& file) {
+        std::cout << file << std::endl;
+        count++;
+        return true;
+    });
+    if (!valid) {
+        std::cerr << files.error() << std::endl;
+        return 1;
+    }
+    if (verbose) {
+        std::cout << count << " files" << std::endl;
+    }
+    return 0;
+}
@@ -12,6 +12,16 @@
 #include <iostream>
 #include <tuple>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <array>
+#include <string_view>
+#include <cstdint>
+#include <algorithm>
+#include <memory_resource>
+#include <bit>
+#include <cstring>
 
 
 namespace argparse {
@@ -22,32 +32,120 @@ static constexpr bool is_optional = false;
 template <typename T>
 static constexpr bool is_optional<std::optional<T>> = true;
 
+// Converts a word to a value of type T. Specialise it to support other
+// output types, eg:
+//
+//   template <>
+//   struct argparse::value_parser<Duration> {
+//       static bool parse(std::string_view word, Duration& value, std::string& error);
+//       // Optional, used to show default values in the help
+//       static void format(std::ostream& os, const Duration& value);
+//   };
+//
+// Without format, default values are shown using operator<< if there is one.
 template <typename T>
-concept is_simple_t =
+struct value_parser;
+
+template <typename T>
+concept has_value_parser = requires(std::string_view word, T& value, std::string& error) {
+    { value_parser<T>::parse(word, value, error) } -> std::same_as<bool>;
+};
+
+// Numeric outputs are listed by their fundamental types, so that the fixed
+// width aliases (std::int64_t, std::uint64_t, std::uint32_t, std::size_t, ...)
+// are all supported without repeating a type
+template <typename T>
+concept is_number_t =
     std::is_same_v<T, int>
-    || std::is_same_v<T, double>
-    || std::is_same_v<T, std::string>;
+    || std::is_same_v<T, long>
+    || std::is_same_v<T, long long>
+    || std::is_same_v<T, unsigned int>
+    || std::is_same_v<T, unsigned long>
+    || std::is_same_v<T, unsigned long long>
+    || std::is_same_v<T, float>
+    || std::is_same_v<T, double>;
+
+template <is_number_t T>
+struct value_parser<T> {
+    static bool parse(std::string_view word, T& value, std::string& error);
+};
+
+template <>
+struct value_parser<std::string> {
+    static bool parse(std::string_view word, std::string& value, std::string& error);
+};
+
+// Accepts 1/0, true/false, yes/no and on/off, for flags given by an
+// environment variable or config file
+template <>
+struct value_parser<bool> {
+    static bool parse(std::string_view word, bool& value, std::string& error);
+};
+
+// Enum outputs must be given choices, which map each name to a value
+template <typename T>
+concept is_enum_t = std::is_enum_v<T>;
+
+template <typename T>
+static constexpr bool is_enum_output = std::is_enum_v<T>;
+
+template <typename T>
+static constexpr bool is_enum_output<std::optional<T>> = std::is_enum_v<T>;
+
+// Outputs which take a single word
+template <typename T>
+concept is_simple_t =
+    is_enum_t<T>
+    || (has_value_parser<T> && !std::is_same_v<T, bool>);
+
+template <typename T>
+static constexpr bool is_number_vector = false;
+
+template <is_number_t T>
+static constexpr bool is_number_vector<std::vector<T>> = true;
+
+template <typename T>
+class ListStream;
+
+template <typename T>
+static constexpr bool is_list_stream = false;
+
+template <is_simple_t T>
+static constexpr bool is_list_stream<ListStream<T>> = true;
+
+template <typename T>
+static constexpr bool is_enum_output<ListStream<T>> = std::is_enum_v<T>;
+
+// List outputs collect all remaining words. The string_view and span outputs
+// refer directly to the words in argv, so are only valid while argv is.
+// Numeric lists convert each word. ListStream outputs convert each word, or
+// each element read from a file descriptor, as it is read.
+template <typename T>
+concept is_list_t =
+    std::is_same_v<T, std::vector<std::string>>
+    || std::is_same_v<T, std::vector<std::string_view>>
+    || std::is_same_v<T, std::span<const char* const>>
+    || is_number_vector<T>
+    || is_list_stream<T>;
+
+// Lists which refer to the words they were given rather than owning copies.
+// Each parse which doesn't give them resets them to empty, so they never
+// refer to the words of an earlier parse, and they have no other default.
+template <typename T>
+concept is_view_list_t =
+    std::is_same_v<T, std::vector<std::string_view>>
+    || std::is_same_v<T, std::span<const char* const>>
+    || is_list_stream<T>;
 
 template <typename T>
 concept is_optional_t =
-    is_optional<T>
+    (is_optional<T> && is_simple_t<typename T::value_type>)
     || std::is_same_v<T, bool>
-    || std::is_same_v<T, std::vector<std::string>>;
+    || is_list_t<T>;
 
 template <typename T>
 concept is_output_t = is_simple_t<T> || is_optional_t<T>;
 
-using output_ptr_t = std::variant<
-    int*,
-    std::optional<int>*,
-    double*,
-    std::optional<double>*,
-    std::string*,
-    std::optional<std::string>*,
-    bool*,
-    std::vector<std::string>*
->;
-
 class UsageError: public std::runtime_error {
 public:
     UsageError(const std::string& message):
@@ -60,73 +158,1238 @@ enum class ItemType {
     Flag
 };
 
+namespace detail {
+
+constexpr bool is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool is_alnum(char c) {
+    return is_alpha(c) || (c >= '0' && c <= '9');
+}
+
+constexpr bool validate_word(std::string_view word) {
+    if (word.empty()) return false;
+    if (!is_alpha(word[0])) return false;
+    for (char c: word) {
+        if (!is_alnum(c) && c != '-' && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the error message for an invalid flag alias, or nullptr if valid.
+// Runtime parsers accept multi-letter single-dash aliases such as "-vv", as
+// they always have; a Schema requires single-dash aliases to be one letter.
+constexpr const char* validate_flag(std::string_view flag, bool strict_short = false) {
+    if (flag == "-h" || flag == "--help") {
+        return "Cannot use flags '-h' and '--help', reserved for printing help message";
+    }
+    if (flag.size() >= 2 && flag[1] == '-') {
+        if (!validate_word(flag.substr(2))) {
+            return "Invalid flag";
+        }
+    } else if (strict_short ? flag.size() != 2 || !is_alpha(flag[1])
+                            : flag.size() < 2 || (flag.size() != 2 && !is_alpha(flag[1]))) {
+        return "Invalid flag";
+    }
+    return nullptr;
+}
+
+// Whether an argv word is a flag rather than a value. Negative numbers are
+// values, as is "-", which conventionally names standard input.
+constexpr bool is_flag_word(std::string_view word) {
+    return word.size() > 1 && word[0] == '-' && (word[1] == '-' || word[1] < '0' || word[1] > '9');
+}
+
+// Calls visitor(part) for each '|' separated alias of a flag identifier
+template <typename Visitor>
+constexpr void split_flags(std::string_view identifier, Visitor&& visitor) {
+    std::size_t part_begin = 0;
+    while (true) {
+        std::size_t part_end = identifier.find('|', part_begin);
+        if (part_end == std::string_view::npos) {
+            visitor(identifier.substr(part_begin));
+            return;
+        }
+        visitor(identifier.substr(part_begin, part_end - part_begin));
+        part_begin = part_end + 1;
+    }
+}
+
+constexpr std::uint64_t hash_word(std::string_view word) {
+    // FNV-1a, followed by a murmur finaliser so that all bits are usable
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c: word) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+constexpr std::size_t perfect_hash_buckets(std::size_t keys) {
+    return keys / 2 + 1;
+}
+
+constexpr std::size_t perfect_hash_slots(std::size_t keys) {
+    return keys + keys / 4 + 1;
+}
+
+// Each displacement remixes the hash, so keys which collide for one
+// displacement are independent for the next, even in small tables
+constexpr std::size_t perfect_hash_slot(std::uint64_t hash, std::uint32_t displacement, std::size_t slots) {
+    std::uint64_t h = hash + displacement * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return h % slots;
+}
+
+// Hash-and-displace construction: keys are grouped into buckets, and each
+// bucket (largest first) searches for a displacement which places all of its
+// keys into free slots. Lookup is then a single probe with no collisions.
+// Returns false if no displacement could be found for some bucket.
+constexpr bool build_perfect_hash(
+    std::span<const std::uint64_t> hashes,
+    std::span<std::uint32_t> displacements,
+    std::span<std::uint32_t> slots)
+{
+    constexpr std::uint32_t empty = 0xffffffff;
+    constexpr std::uint32_t max_displacement = 1 << 20;
+    const std::size_t num_buckets = displacements.size();
+
+    std::vector<std::size_t> bucket_begin(num_buckets + 1, 0);
+    for (auto hash: hashes) {
+        bucket_begin[hash % num_buckets + 1]++;
+    }
+    for (std::size_t b = 0; b < num_buckets; b++) {
+        bucket_begin[b + 1] += bucket_begin[b];
+    }
+    std::vector<std::size_t> bucket_keys(hashes.size());
+    {
+        std::vector<std::size_t> fill(bucket_begin.begin(), bucket_begin.end() - 1);
+        for (std::size_t i = 0; i < hashes.size(); i++) {
+            bucket_keys[fill[hashes[i] % num_buckets]++] = i;
+        }
+    }
+    std::vector<std::size_t> order(num_buckets);
+    for (std::size_t b = 0; b < num_buckets; b++) {
+        order[b] = b;
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs) {
+        return bucket_begin[lhs + 1] - bucket_begin[lhs] > bucket_begin[rhs + 1] - bucket_begin[rhs];
+    });
+
+    for (auto& slot: slots) {
+        slot = empty;
+    }
+    for (auto& displacement: displacements) {
+        displacement = 0;
+    }
+
+    for (std::size_t b: order) {
+        std::size_t begin = bucket_begin[b];
+        std::size_t end = bucket_begin[b + 1];
+        if (begin == end) break;
+
+        std::uint32_t displacement = 0;
+        while (true) {
+            bool valid = true;
+            for (std::size_t i = begin; i < end && valid; i++) {
+                std::size_t slot = perfect_hash_slot(hashes[bucket_keys[i]], displacement, slots.size());
+                if (slots[slot] != empty) {
+                    valid = false;
+                }
+                for (std::size_t j = begin; j < i && valid; j++) {
+                    if (slot == perfect_hash_slot(hashes[bucket_keys[j]], displacement, slots.size())) {
+                        valid = false;
+                    }
+                }
+            }
+            if (valid) break;
+            displacement++;
+            if (displacement == max_displacement) {
+                return false;
+            }
+        }
+
+        displacements[b] = displacement;
+        for (std::size_t i = begin; i < end; i++) {
+            std::size_t slot = perfect_hash_slot(hashes[bucket_keys[i]], displacement, slots.size());
+            slots[slot] = bucket_keys[i];
+        }
+    }
+    return true;
+}
+
+// Allows unordered_map<std::string, ...> lookup by string_view without
+// constructing a temporary string
+struct StringHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view word) const {
+        return std::hash<std::string_view>()(word);
+    }
+};
+
+} // namespace detail
+
+// Non-owning view of a perfect hash table mapping flag aliases to item indices
+struct FlagTable {
+    std::span<const std::uint32_t> displacements;
+    std::span<const std::uint32_t> slots;
+    std::span<const std::string_view> keys;
+    std::span<const std::size_t> key_items;
+
+    constexpr std::optional<std::size_t> find(std::string_view word) const {
+        if (keys.empty()) return std::nullopt;
+        std::uint64_t hash = detail::hash_word(word);
+        std::uint32_t displacement = displacements[hash % displacements.size()];
+        std::uint32_t key = slots[detail::perfect_hash_slot(hash, displacement, slots.size())];
+        if (key >= keys.size() || keys[key] != word) {
+            return std::nullopt;
+        }
+        return key_items[key];
+    }
+};
+
+// Type-erased view of a Schema, used by Parser
+struct SchemaView {
+    std::span<const std::string_view> identifiers;
+    std::span<const ItemType> types;
+    FlagTable flags;
+};
+
+template <std::size_t N>
+struct FixedString {
+    char data[N] = {};
+    consteval FixedString(const char (&str)[N]) {
+        std::copy_n(str, N, data);
+    }
+    constexpr std::string_view view() const {
+        return std::string_view(data, N - 1);
+    }
+};
+
+// Compile-time schema of item identifiers.
+// Identifiers are validated during compilation and the flag lookup table is
+// generated as a perfect hash, so constructing a Parser from a schema does no
+// identifier parsing or hash map insertion at runtime. Outputs are still bound
+// with Parser::add, which must be called with the identifiers in schema order.
+template <FixedString... Identifiers>
+class Schema {
+    static constexpr std::size_t count_flags() {
+        std::size_t count = 0;
+        for (std::string_view identifier: {Identifiers.view()...}) {
+            if (identifier.empty() || identifier[0] != '-') continue;
+            detail::split_flags(identifier, [&](std::string_view) { count++; });
+        }
+        return count;
+    }
+
+public:
+    static constexpr std::size_t size = sizeof...(Identifiers);
+    static constexpr std::size_t num_flags = count_flags();
+
+    static constexpr std::array<std::string_view, size> identifiers = {Identifiers.view()...};
+
+    static constexpr std::array<ItemType, size> types = [] {
+        std::array<ItemType, size> types = {};
+        for (std::size_t i = 0; i < size; i++) {
+            std::string_view identifier = identifiers[i];
+            if (identifier.empty()) {
+                throw "Identifier cannot be empty";
+            }
+            if (identifier[0] != '-') {
+                if (!detail::validate_word(identifier)) {
+                    throw "Invalid identifier";
+                }
+                types[i] = ItemType::Arg;
+                continue;
+            }
+            detail::split_flags(identifier, [](std::string_view part) {
+                if (const char* error = detail::validate_flag(part, true)) {
+                    throw error;
+                }
+            });
+            types[i] = ItemType::Flag;
+        }
+        return types;
+    }();
+
+private:
+    struct Keys {
+        std::array<std::string_view, num_flags> keys = {};
+        std::array<std::size_t, num_flags> items = {};
+    };
+
+    static constexpr Keys keys = [] {
+        Keys keys;
+        std::size_t key_i = 0;
+        for (std::size_t i = 0; i < size; i++) {
+            if (types[i] != ItemType::Flag) continue;
+            detail::split_flags(identifiers[i], [&](std::string_view part) {
+                keys.keys[key_i] = part;
+                keys.items[key_i] = i;
+                key_i++;
+            });
+        }
+        std::array<std::string_view, num_flags> sorted = keys.keys;
+        std::sort(sorted.begin(), sorted.end());
+        if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+            throw "Duplicate flag";
+        }
+        return keys;
+    }();
+
+    struct Table {
+        std::array<std::uint32_t, detail::perfect_hash_buckets(num_flags)> displacements = {};
+        std::array<std::uint32_t, detail::perfect_hash_slots(num_flags)> slots = {};
+    };
+
+    static constexpr Table table = [] {
+        Table table;
+        std::array<std::uint64_t, num_flags> hashes = {};
+        for (std::size_t i = 0; i < num_flags; i++) {
+            hashes[i] = detail::hash_word(keys.keys[i]);
+        }
+        if (!detail::build_perfect_hash(hashes, table.displacements, table.slots)) {
+            throw "Failed to build perfect hash for flags";
+        }
+        return table;
+    }();
+
+public:
+    static constexpr SchemaView view = {
+        identifiers,
+        types,
+        FlagTable{ table.displacements, table.slots, keys.keys, keys.items }
+    };
+};
+
+// Allowed values for an item, looked up by perfect hash. Choices for integer
+// and enum outputs may also map each name to the value to write to the
+// output. The names and tables are stored in the parser's arena.
+struct Choices {
+    std::span<const std::string_view> names;
+    std::span<const std::int64_t> values;
+    std::span<const std::uint32_t> displacements;
+    std::span<const std::uint32_t> slots;
+
+    bool empty() const {
+        return names.empty();
+    }
+    bool has_values() const {
+        return !values.empty();
+    }
+    std::optional<std::size_t> find(std::string_view word) const {
+        if (names.empty()) return std::nullopt;
+        std::uint64_t hash = detail::hash_word(word);
+        std::uint32_t displacement = displacements[hash % displacements.size()];
+        std::uint32_t key = slots[detail::perfect_hash_slot(hash, displacement, slots.size())];
+        if (key >= names.size() || names[key] != word) {
+            return std::nullopt;
+        }
+        return key;
+    }
+    std::string_view name_of(std::int64_t value) const {
+        auto iter = std::find(values.begin(), values.end(), value);
+        if (iter == values.end()) {
+            return "";
+        }
+        return names[iter - values.begin()];
+    }
+};
+
+inline constexpr Choices no_choices = {};
+
+// Snapshot of the process environment, taken once on first use and indexed
+// by name. Later changes to the environment, eg: by setenv, are not seen.
+class Environment {
+public:
+    static const Environment& get();
+    std::optional<std::string_view> find(std::string_view name) const;
+private:
+    Environment();
+    std::string data;
+    std::unordered_map<std::string_view, std::string_view> values;
+};
+
+template <typename T>
+struct choice_value {};
+
+template <typename T>
+requires is_enum_t<T> || (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+struct choice_value<T> {
+    using type = T;
+};
+
+template <typename T>
+struct choice_value<std::optional<T>>: public choice_value<T> {};
+
+template <typename T>
+struct choice_value<ListStream<T>>: public choice_value<T> {};
+
+// Order-independent 128-bit hash of a parse result, see ParseOptions
+struct Fingerprint {
+    std::uint64_t low = 0;
+    std::uint64_t high = 0;
+
+    bool operator==(const Fingerprint&) const = default;
+
+    // Fingerprints are sums of per-item contributions
+    Fingerprint& operator+=(const Fingerprint& other) {
+        low += other.low;
+        high += other.high;
+        return *this;
+    }
+    Fingerprint& operator-=(const Fingerprint& other) {
+        low -= other.low;
+        high -= other.high;
+        return *this;
+    }
+};
+
+namespace detail {
+
+// Hashes a sequence of words and strings into a Fingerprint, with two
+// independent 64-bit lanes. The result is stable across runs and builds.
+class FingerprintHasher {
+public:
+    void add(std::uint64_t word) {
+        a = std::rotl((a ^ word) * 0x9e3779b97f4a7c15ull, 27);
+        b = std::rotl((b + word) * 0xc2b2ae3d27d4eb4full, 31) ^ a;
+    }
+    void add(std::string_view text) {
+        add(static_cast<std::uint64_t>(text.size()));
+        std::size_t i = 0;
+        for (; i + 8 <= text.size(); i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, text.data() + i, 8);
+            add(word);
+        }
+        if (i != text.size()) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, text.data() + i, text.size() - i);
+            add(word);
+        }
+    }
+    Fingerprint finish() const {
+        return Fingerprint{ mix(a), mix(b ^ std::rotl(a, 32)) };
+    }
+private:
+    static std::uint64_t mix(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+    std::uint64_t a = 0x243f6a8885a308d3ull;
+    std::uint64_t b = 0x13198a2e03707344ull;
+};
+
+} // namespace detail
+
+// Why a parse failed
+enum class ParseError {
+    None,
+    // -h or --help was given
+    Help,
+    // A __complete command was handled, and its output written
+    Completion,
+    ResponseFile,
+    Config,
+    UnknownFlag,
+    // A flag taking a value was the final word
+    MissingFlagValue,
+    ExtraArgument,
+    InvalidSubcommand,
+    MissingSubcommand,
+    // A word couldn't be converted for its item
+    InvalidValue,
+    // A word wasn't one of its item's choices
+    InvalidChoice,
+    // An item's environment variable couldn't be converted
+    InvalidEnvironmentValue,
+    // A required item wasn't given a value
+    MissingValue,
+};
+
+enum class OutputKind {
+    Value,
+    // Set to true by the flag alone
+    Flag,
+    // Collects the remaining words
+    List
+};
+
+namespace detail {
+
+// Message for a word which isn't one of the choices, with suggestions
+std::string invalid_choice(std::string_view word, const Choices& choices);
+
+// Conversions for an output of type T, instantiated by Parser::add so that
+// items call straight into the conversion for their type. Returns None,
+// InvalidValue with the converter's error, or InvalidChoice with no error,
+// leaving its message to invalid_choice() if it is needed.
+template <typename T>
+ParseError convert_value(std::string_view word, const Choices& choices, T& value, std::string& error) {
+    if constexpr(is_optional<T>) {
+        value.emplace();
+        return convert_value(word, choices, value.value(), error);
+    } else {
+        if (!choices.empty()) {
+            auto choice = choices.find(word);
+            if (!choice.has_value()) {
+                return ParseError::InvalidChoice;
+            }
+            if constexpr(requires { typename choice_value<T>::type; }) {
+                if (choices.has_values()) {
+                    value = static_cast<T>(choices.values[choice.value()]);
+                    return ParseError::None;
+                }
+            }
+        }
+        if constexpr(is_enum_t<T>) {
+            // Validation requires choices with values for enums
+            assert(false);
+            return ParseError::InvalidValue;
+        } else {
+            return value_parser<T>::parse(word, value, error) ? ParseError::None : ParseError::InvalidValue;
+        }
+    }
+}
+
+// As convert_value(), but with the message formatted for invalid choices
+template <typename T>
+bool convert_value_or_error(std::string_view word, const Choices& choices, T& value, std::string& error) {
+    ParseError conversion = convert_value(word, choices, value, error);
+    if (conversion == ParseError::InvalidChoice) {
+        error = invalid_choice(word, choices);
+    }
+    return conversion == ParseError::None;
+}
+
+template <typename T>
+ParseError convert_thunk(std::string_view word, const Choices& choices, void* output, std::string& error) {
+    return convert_value(word, choices, *static_cast<T*>(output), error);
+}
+
+// Converts each word to a number in output, which has the same size.
+// Integers of up to 15 digits are converted with SSE2 where available.
+// Returns the number of words converted, which is less than words.size()
+// if one is invalid.
+template <is_number_t T>
+std::size_t parse_numbers(std::span<const char*> words, T* output, std::string& error);
+
+// Lists with at least this many words are split into chunks when converted
+// with more than one thread
+inline constexpr std::size_t parallel_list_min_words = 65536;
+
+// Calls convert(begin, end, error) for consecutive chunks of [0, size), one
+// per thread, each returning the number of its words converted. Every chunk
+// is converted, and the result and error are those of the first chunk with
+// an invalid word, so are the same as converting on one thread.
+std::size_t convert_chunks(
+    std::size_t size,
+    unsigned threads,
+    const std::function<std::size_t(std::size_t begin, std::size_t end, std::string& error)>& convert,
+    std::string& error);
+
+// Returns the number of words before the first which isn't one of the
+// choices, checked in chunks as for convert_chunks()
+std::size_t count_choices(std::span<const char*> words, const Choices& choices, unsigned threads);
+
+// Returns the number of words converted, as for parse_numbers(). Words are
+// checked against choices first, and only those before the first invalid
+// choice are converted.
+template <typename T>
+std::size_t assign_list_thunk(std::span<const char*> words, void* output, const Choices& choices, std::string& error, unsigned threads) {
+    T& list = *static_cast<T*>(output);
+    if constexpr(!is_list_stream<T>) {
+        if (!choices.empty()) {
+            words = words.first(count_choices(words, choices, threads));
+        }
+    }
+    if constexpr(std::is_same_v<T, std::span<const char* const>>) {
+        list = words;
+    } else if constexpr(is_number_vector<T>) {
+        list.resize(words.size());
+        if (threads <= 1 || words.size() < parallel_list_min_words) {
+            return parse_numbers(words, list.data(), error);
+        }
+        return convert_chunks(words.size(), threads, [&](std::size_t begin, std::size_t end, std::string& chunk_error) {
+            return parse_numbers(words.subspan(begin, end - begin), list.data() + begin, chunk_error);
+        }, error);
+    } else if constexpr(is_list_stream<T>) {
+        // Converted by ListStream::read()
+        list.words = words;
+        list.from_input = words.empty() || (words.size() == 1 && std::string_view(words[0]) == "-");
+    } else if (threads > 1 && words.size() >= parallel_list_min_words) {
+        list.resize(words.size());
+        return convert_chunks(words.size(), threads, [&](std::size_t begin, std::size_t end, std::string&) {
+            std::copy(words.begin() + begin, words.begin() + end, list.begin() + begin);
+            return end - begin;
+        }, error);
+    } else {
+        list.assign(words.begin(), words.end());
+    }
+    return words.size();
+}
+
+template <typename T>
+void format_thunk(std::ostream& os, const void* output, const Choices& choices) {
+    const T& value = *static_cast<const T*>(output);
+    if constexpr(is_enum_t<T>) {
+        os << choices.name_of(static_cast<std::int64_t>(value));
+    } else if constexpr(requires { value_parser<T>::format(os, value); }) {
+        value_parser<T>::format(os, value);
+    } else {
+        os << value;
+    }
+}
+
+// Hashes the resolved value, so eg: "05" and "+5" hash the same as "5".
+// Custom types are hashed by value_parser<T>::hash if provided, returning
+// a std::uint64_t, or else by std::hash.
+template <typename T>
+void hash_value(FingerprintHasher& hasher, const T& value) {
+    if constexpr(is_optional<T>) {
+        hasher.add(std::uint64_t(value.has_value()));
+        if (value.has_value()) {
+            hash_value(hasher, value.value());
+        }
+    } else if constexpr(std::is_integral_v<T> || is_enum_t<T>) {
+        hasher.add(static_cast<std::uint64_t>(value));
+    } else if constexpr(std::is_floating_point_v<T>) {
+        hasher.add(std::bit_cast<std::uint64_t>(static_cast<double>(value)));
+    } else if constexpr(std::is_convertible_v<const T&, std::string_view>) {
+        hasher.add(std::string_view(value));
+    } else if constexpr(is_list_t<T>) {
+        hasher.add(static_cast<std::uint64_t>(value.size()));
+        for (const auto& element: value) {
+            hash_value(hasher, element);
+        }
+    } else if constexpr(requires { { value_parser<T>::hash(value) } -> std::convertible_to<std::uint64_t>; }) {
+        hasher.add(static_cast<std::uint64_t>(value_parser<T>::hash(value)));
+    } else {
+        hasher.add(static_cast<std::uint64_t>(std::hash<T>()(value)));
+    }
+}
+
+template <typename T>
+void hash_thunk(FingerprintHasher& hasher, const void* output) {
+    hash_value(hasher, *static_cast<const T*>(output));
+}
+
+template <typename T>
+constexpr bool is_hashable =
+    is_enum_t<T>
+    || std::is_arithmetic_v<T>
+    || std::is_convertible_v<const T&, std::string_view>
+    || (is_list_t<T> && !is_list_stream<T>)
+    || requires(const T& value) { { value_parser<T>::hash(value) } -> std::convertible_to<std::uint64_t>; }
+    || requires(const T& value) { std::hash<T>()(value); };
+
+template <typename T>
+constexpr bool is_hashable<std::optional<T>> = is_hashable<T>;
+
+// Compares resolved values, with C string list elements compared by content
+template <typename T>
+bool equal_value(const T& a, const T& b) {
+    if constexpr(is_optional<T>) {
+        if (a.has_value() != b.has_value()) {
+            return false;
+        }
+        return !a.has_value() || equal_value(a.value(), b.value());
+    } else if constexpr(std::is_same_v<T, const char*>) {
+        return std::string_view(a) == std::string_view(b);
+    } else if constexpr(is_list_t<T>) {
+        return std::ranges::equal(a, b, [](const auto& x, const auto& y) {
+            return equal_value(x, y);
+        });
+    } else {
+        return a == b;
+    }
+}
+
+template <typename T>
+bool equal_thunk(const void* a, const void* b) {
+    return equal_value(*static_cast<const T*>(a), *static_cast<const T*>(b));
+}
+
+template <typename T>
+void copy_thunk(const void* from, void* to) {
+    *static_cast<T*>(to) = *static_cast<const T*>(from);
+}
+
+template <typename T>
+constexpr bool is_comparable =
+    (is_list_t<T> && !is_list_stream<T>)
+    || requires(const T& value) { { value == value } -> std::convertible_to<bool>; };
+
+template <typename T>
+constexpr bool is_comparable<std::optional<T>> = is_comparable<T>;
+
+template <typename T>
+constexpr bool is_formattable =
+    is_simple_t<T>
+    && (is_enum_t<T>
+        || requires(std::ostream& os, const T& value) { value_parser<T>::format(os, value); }
+        || requires(std::ostream& os, const T& value) { os << value; });
+
+// The conversions for one output type, in a static table shared by every
+// item of that type
+struct OutputOps {
+    // Null for lists
+    ParseError (*convert)(std::string_view word, const Choices& choices, void* output, std::string& error);
+    // Returns the number of words converted, null for other outputs
+    std::size_t (*assign_list)(std::span<const char*> words, void* output, const Choices& choices, std::string& error, unsigned threads);
+    // Writes the default value for the help, or null if not shown
+    void (*format)(std::ostream& os, const void* output, const Choices& choices);
+    // Adds the value to a fingerprint, or null if the type can't be hashed
+    void (*hash)(FingerprintHasher& hasher, const void* output);
+    // Compares two values, or null if the type has no ==
+    bool (*equal)(const void* a, const void* b);
+    void (*copy)(const void* from, void* to);
+};
+
+template <typename T>
+constexpr OutputOps make_output_ops() {
+    OutputOps ops = {};
+    if constexpr(is_list_t<T>) {
+        ops.assign_list = &assign_list_thunk<T>;
+    } else {
+        ops.convert = &convert_thunk<T>;
+    }
+    if constexpr(is_formattable<T>) {
+        ops.format = &format_thunk<T>;
+    }
+    if constexpr(is_hashable<T>) {
+        ops.hash = &hash_thunk<T>;
+    }
+    if constexpr(is_comparable<T>) {
+        ops.equal = &equal_thunk<T>;
+    }
+    ops.copy = &copy_thunk<T>;
+    return ops;
+}
+
+template <typename T>
+inline constexpr OutputOps output_ops = make_output_ops<T>();
+
+} // namespace detail
+
+namespace detail {
+
+// Splits the input from fd at each separator, calling callback with each
+// non-empty element until it returns false. Only a partial element left at
+// the end of a read is copied. Returns false if reading fails.
+bool read_elements(
+    int fd,
+    char separator,
+    const std::function<bool(std::string_view)>& callback,
+    std::string& error);
+
+} // namespace detail
+
+// List output whose elements are delivered one at a time by read(), rather
+// than collected. They are the words given in argv or, if there are none or
+// the only word is "-", the elements read from a file descriptor: standard
+// input separated by newlines, unless set by ItemHandle::read_from(), eg: '\0'
+// for `find -print0`. Each is converted and checked against the choices like
+// any other value. Memory doesn't grow with the input, and the work on each
+// element can start before the input ends.
+template <typename T>
+class ListStream {
+public:
+    // Calls callback with each element until it returns false. Returns false
+    // if an element is invalid or the input can't be read, see error().
+    template <typename F>
+    requires std::is_invocable_r_v<bool, F&, const T&>
+    bool read(F&& callback) {
+        T value{};
+        bool valid = true;
+        auto deliver = [&](std::string_view word) {
+            if (!detail::convert_value_or_error(word, choices, value, error_message)) {
+                valid = false;
+                return false;
+            }
+            return static_cast<bool>(callback(static_cast<const T&>(value)));
+        };
+        if (!from_input) {
+            for (const char* word: words) {
+                if (!deliver(word)) break;
+            }
+            return valid;
+        }
+        return detail::read_elements(fd, separator, deliver, error_message) && valid;
+    }
+
+    // Whether the elements are read from the file descriptor
+    bool reads_input() const {
+        return from_input;
+    }
+    const std::string& error() const {
+        return error_message;
+    }
+
+private:
+    std::span<const char* const> words;
+    bool from_input = true;
+    int fd = 0;
+    char separator = '\n';
+    Choices choices;
+    std::string error_message;
+
+    template <typename U>
+    friend std::size_t detail::assign_list_thunk(std::span<const char*> words, void* output, const Choices& choices, std::string& error, unsigned threads);
+    template <typename U>
+    friend class ItemHandle;
+};
+
+// Strings and choices refer to the parser's arena
 struct Item {
-    output_ptr_t output;
-    std::string identifier;
+    // Output, and the conversions generated for its type
+    void* output;
+    const detail::OutputOps* ops;
+
+    std::string_view identifier;
+    // Never null, items without choices point to no_choices
+    const Choices* choices;
+    std::string_view help;
+    std::string_view env;
+    OutputKind kind;
     ItemType type;
     bool has_default;
     bool is_optional;
-    std::vector<std::string> choices;
-    std::string help;
+    bool requires_choice_values;
+    // Reset by each parse which doesn't give it, see is_view_list_t
+    bool is_view_list;
 };
 
+// Destination for help and error messages
+using Sink = std::function<void(std::string_view)>;
+
+// Writes to a file descriptor, with a single write call where possible
+Sink fd_sink(int fd);
+// Appends to a string
+Sink buffer_sink(std::string& buffer);
+// Writes to std::cout, without flushing
+extern const Sink stdout_sink;
+
+// Rendered help message, kept until the parser is modified
+class HelpCache {
+public:
+    HelpCache() = default;
+    HelpCache(const HelpCache&) = delete;
+    HelpCache& operator=(const HelpCache&) = delete;
+
+    void invalidate() {
+        std::lock_guard<std::mutex> lock(mutex);
+        valid = false;
+    }
+    // Calls write with the cached help, rendering it first if required
+    void write(
+        std::string_view program,
+        const std::function<std::string()>& render,
+        const std::function<void(const std::string&)>& write) const;
+
+private:
+    mutable std::mutex mutex;
+    mutable bool valid = false;
+    mutable std::string program;
+    mutable std::string text;
+};
+
+class Parser;
+
+// Refers to an item by its index, so remains valid as more items are added
 template <typename T>
 class ItemHandle {
 public:
-    ItemHandle(T* output, Item* item):
+    ItemHandle(T* output, Parser* parser, std::size_t index):
         output(output),
-        item(item)
+        parser(parser),
+        index(index)
     {}
     template <typename S>
-    requires std::is_convertible_v<S, T>
+    requires std::is_convertible_v<S, T> && (!is_view_list_t<T>)
     ItemHandle& default_value(const S& value) {
+        Item& item = this->item();
         *output = value;
-        item->has_default = true;
+        item.has_default = true;
         return *this;
     }
     template <typename S>
-    requires std::is_convertible_v<S, T>
+    requires std::is_convertible_v<S, T> && (!is_view_list_t<T>)
     ItemHandle& default_value(const std::optional<S>& value) {
+        Item& item = this->item();
         if (!value.has_value()) {
             return *this;
         }
         *output = value.value();
-        item->has_default = true;
-        return *this;
-    }
-    ItemHandle& choices(const std::vector<std::string>& choices) {
-        if (choices.empty()) {
-            throw UsageError("Choices cannot be empty");
-        }
-        item->choices = choices;
+        item.has_default = true;
         return *this;
     }
-    ItemHandle& help(const std::string& help) {
-        item->help = help;
+    // Names the value must be one of. For lists, each element must be one of
+    // them, and the first which isn't fails the parse. Enum outputs must use
+    // the overload below, which is checked during compilation.
+    ItemHandle& choices(const std::vector<std::string>& choices)
+    requires (!is_enum_output<T>);
+    // Choices which also give the value to write to an integer or enum output.
+    // The names are only known at runtime, so a duplicate name throws
+    // UsageError here, and an enum item without choices throws UsageError
+    // from finalize() or parse(). Enumerators missing from the choices can't
+    // be detected, and are never written.
+    template <typename S = T>
+    requires requires { typename choice_value<S>::type; }
+    ItemHandle& choices(std::initializer_list<std::pair<std::string, typename choice_value<S>::type>> choices);
+    ItemHandle& help(const std::string& help);
+    // Environment variable to read the value from if not given in argv,
+    // taking priority over the default value
+    ItemHandle& env(const std::string& name)
+    requires (!is_list_t<T>);
+    // File descriptor and separator for the elements of a ListStream, read
+    // when no words are given in argv or the only word is "-"
+    ItemHandle& read_from(int fd, char separator = '\n')
+    requires is_list_stream<T>
+    {
+        output->fd = fd;
+        output->separator = separator;
         return *this;
     }
 private:
+    // The item, for modification
+    Item& item();
+
     T* output;
-    Item* item;
+    Parser* parser;
+    std::size_t index;
 };
 
-class Parser;
-
 class Args {
 public:
     virtual void build(Parser& parser) = 0;
 };
 
+// Splits text into words using shell-style quoting and escapes. Words are
+// unquoted and NUL terminated in place, so text must have one writable byte
+// after size. Returns false if a quote is left unterminated.
+bool tokenize(char* text, std::size_t size, std::vector<const char*>& words);
+
+// Expands '@path' words into the words contained in the file at path, which
+// may themselves include further '@path' words.
+// Files are memory mapped and tokenized in place, so the expanded words are
+// valid for as long as the ResponseFiles object exists.
+class ResponseFiles {
+public:
+    ResponseFiles() = default;
+    ResponseFiles(const ResponseFiles&) = delete;
+    ResponseFiles& operator=(const ResponseFiles&) = delete;
+    ~ResponseFiles();
+
+    // Returns false if a file can't be read, see error(). Frees the words
+    // of the files from the previous call, so outputs of the previous parse
+    // which refer to them become invalid.
+    [[nodiscard]] bool expand(int argc, const char** argv);
+
+    const std::string& error() const {
+        return error_message;
+    }
+
+    int argc() const {
+        return words.size();
+    }
+    const char** argv() {
+        return words.data();
+    }
+
+private:
+    struct Mapping {
+        void* data;
+        std::size_t size;
+    };
+    bool expand_file(const char* path, std::vector<std::pair<std::uint64_t, std::uint64_t>>& open_files);
+    void unmap();
+
+    std::vector<Mapping> mappings;
+    std::vector<const char*> words;
+    std::string error_message;
+};
+
+#ifdef ARGPARSE_STATS
+inline constexpr bool stats_enabled = true;
+#else
+inline constexpr bool stats_enabled = false;
+#endif
+
+// Where time goes during parsing, accumulated over calls which are given the
+// same ParseStats. Only recorded if the library is built with ARGPARSE_STATS,
+// otherwise the instrumentation compiles to nothing and this stays zeroed.
+struct ParseStats {
+    using duration_t = std::chrono::nanoseconds;
+    // Checking the structure of the items before parsing
+    duration_t validation{};
+    // Looking up flag names
+    duration_t flag_lookup{};
+    // Converting words into output values
+    duration_t conversion{};
+    // Building subcommand parsers on their first use
+    duration_t subcommand_build{};
+    // Rendering help messages (excluding cached help)
+    duration_t help_rendering{};
+
+    std::size_t parse_count = 0;
+    std::size_t word_count = 0;
+    // Deepest subcommand nesting reached, 1 if no subcommand was used
+    std::size_t max_depth = 0;
+
+    // Optional, returns the number of heap allocations made so far, eg: from
+    // the application's allocator. Used to count allocations during parsing.
+    std::size_t (*allocation_counter)() = nullptr;
+    std::size_t allocations = 0;
+
+    // Current subcommand depth, while parsing
+    std::size_t depth = 0;
+};
+
+namespace detail {
+
+// Adds the time until it is destroyed to one of the ParseStats durations
+class StatsTimer {
+public:
+    StatsTimer(ParseStats* stats, ParseStats::duration_t ParseStats::* phase):
+        stats(stats),
+        phase(phase)
+    {
+        if constexpr(stats_enabled) {
+            if (stats) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+    }
+    ~StatsTimer() {
+        if constexpr(stats_enabled) {
+            if (stats) {
+                stats->*phase += std::chrono::duration_cast<ParseStats::duration_t>(
+                    std::chrono::steady_clock::now() - start);
+            }
+        }
+    }
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+
+private:
+    ParseStats* stats;
+    ParseStats::duration_t ParseStats::* phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Tracks the subcommand depth of one call to parse, and the overall counts
+// for the outermost call
+class StatsScope {
+public:
+    StatsScope(ParseStats* stats, std::size_t word_count):
+        stats(stats)
+    {
+        if constexpr(stats_enabled) {
+            if (!stats) return;
+            if (stats->depth == 0) {
+                stats->parse_count++;
+                stats->word_count += word_count;
+                if (stats->allocation_counter) {
+                    start_allocations = stats->allocation_counter();
+                }
+            }
+            stats->depth++;
+            stats->max_depth = std::max(stats->max_depth, stats->depth);
+        }
+    }
+    ~StatsScope() {
+        if constexpr(stats_enabled) {
+            if (!stats) return;
+            stats->depth--;
+            if (stats->depth == 0 && stats->allocation_counter) {
+                stats->allocations += stats->allocation_counter() - start_allocations;
+            }
+        }
+    }
+    StatsScope(const StatsScope&) = delete;
+    StatsScope& operator=(const StatsScope&) = delete;
+
+private:
+    ParseStats* stats;
+    std::size_t start_allocations = 0;
+};
+
+// Appends everything read from fd until end of file, for files such as
+// pipes which can't be memory mapped. Returns false on a read error.
+bool read_all(int fd, std::string& contents);
+
+} // namespace detail
+
+// Settings file with one "name = value" per line, where names are long flag
+// names without the leading "--". Settings for a subcommand are placed in a
+// section naming it, eg: "[remote add]". Lines starting with '#' or ';' are
+// comments, and values may be wrapped in double quotes.
+// The file is memory mapped, or read if it isn't a regular file, such as a
+// pipe, and read in a single pass during parsing. Values
+// are converted into their outputs, so outputs don't refer into the file;
+// only the views of Settings do, and they are valid while the ConfigFile is.
+class ConfigFile {
+public:
+    struct Setting {
+        std::string_view section;
+        std::string_view key;
+        std::string_view value;
+        std::size_t line;
+        bool valid;
+    };
+    // Position of a reader within the file
+    struct Cursor {
+        std::size_t position = 0;
+        std::size_t line = 0;
+        std::string_view section;
+    };
+
+    ConfigFile() = default;
+    ConfigFile(const ConfigFile&) = delete;
+    ConfigFile& operator=(const ConfigFile&) = delete;
+    ~ConfigFile();
+
+    // Returns false if the file can't be read, see error()
+    [[nodiscard]] bool open(const std::string& path);
+
+    // Reads the next setting after the cursor, or nullopt at the end
+    std::optional<Setting> next(Cursor& cursor) const;
+
+    const std::string& path() const {
+        return file_path;
+    }
+    const std::string& error() const {
+        return error_message;
+    }
+
+private:
+    void close();
+
+    const char* data = nullptr;
+    std::size_t size = 0;
+    // Contents of a file which isn't mapped
+    std::string contents;
+    std::string file_path;
+    std::string error_message;
+};
+
+// Outcome of a parse. Failures are recorded where they are found, as views
+// of the offending word and item, and message() formats them on demand, so
+// failing costs no more than succeeding. Errors from converters, config
+// files and response files are kept in reason, whose storage is reused if
+// the same ParseResult is given to each parse.
+struct ParseResult {
+    ParseError error = ParseError::None;
+    // Offending word, and its index among the words after the program name,
+    // after response files are expanded. Environment variable values have
+    // no index.
+    std::optional<std::size_t> word_index;
+    std::string_view word;
+    // Offending item of the parser which failed
+    const Item* item = nullptr;
+    // The parser which failed, which may be a subcommand's
+    const Parser* parser = nullptr;
+    std::string_view program;
+    std::string reason;
+
+    bool ok() const {
+        return error == ParseError::None;
+    }
+    // Words selecting the parser which failed, eg: " remote add"
+    std::string_view subcommand_path() const;
+    // eg: "Unknown flag '--verbse', did you mean '--verbose'?", or empty
+    // for Help and Completion
+    std::string message() const;
+    // Whether parse() writes the help after the message
+    bool shows_help() const;
+    // Writes what parse() writes without ParseOptions::result
+    void write(const Sink& output) const;
+};
+
+struct ParseOptions {
+    // Per-call storage for parsers with more than 256 items, avoiding a heap
+    // allocation on each parse. Must have at least Parser::scratch_size() words.
+    std::span<std::uint64_t> scratch;
+    // If provided, '@path' words are expanded into this, which must outlive
+    // any string_view or span outputs, and not expand again while they are
+    // in use.
+    ResponseFiles* response_files = nullptr;
+    // Destination for help and error messages, defaults to stdout_sink
+    Sink output;
+    // If provided, and built with ARGPARSE_STATS, records parsing statistics
+    ParseStats* stats = nullptr;
+    // If provided, sets values for items not given in argv or the environment
+    const ConfigFile* config = nullptr;
+    // If provided, set to a hash of the result on success: the resolved
+    // value of every item, and the chosen subcommands. It doesn't depend on
+    // the order of the flags or which alias was used, so can be used as a
+    // cache key. It starts from the contributions of the default values,
+    // computed by finalize(), and is updated as each value is written, so
+    // only parsing into a copy of the defaults with a finalized parser, as
+    // ArgsParser does after finalize(), can compute it. Other parses throw
+    // UsageError, as their outputs may hold values from earlier parses.
+    Fingerprint* fingerprint = nullptr;
+    // If provided, records the outcome, and failures aren't written to output
+    ParseResult* result = nullptr;
+    // Threads converting each list of at least 65536 words, in chunks.
+    // Errors are the same as with one thread: those of the first invalid word.
+    unsigned list_threads = 1;
+};
+
+// Maps outputs bound to the members of one object onto the same members of
+// another object of the same type, so that a parser built once can parse
+// into any number of result objects. Outputs outside the object are unchanged.
+struct Relocation {
+    const void* from = nullptr;
+    void* to = nullptr;
+    std::size_t size = 0;
+    // Set by ArgsParser, whose parses may run concurrently, so subcommand
+    // parsers must have no outputs outside their args either
+    bool outputs_within = false;
+
+    template <typename T>
+    T* apply(T* output) const {
+        auto address = reinterpret_cast<std::uintptr_t>(output);
+        auto begin = reinterpret_cast<std::uintptr_t>(from);
+        if (address - begin >= size) {
+            return output;
+        }
+        return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(to) + (address - begin));
+    }
+};
+
 struct Subcommand {
     using callback_t = std::function<
         bool(
-            const std::string&,
-            std::span<const char*>
+            std::string_view,
+            std::span<const char*>,
+            const ParseOptions&,
+            ParseResult&,
+            const Relocation&
         )
     >;
     std::string name;
     std::string description;
     callback_t callback;
+    // Builds the subcommand parser on first use, without parsing anything.
+    // Used by completion, which only needs the subcommands that were named.
+    std::function<const Parser&()> parser;
 };
 
 template <typename OutputT>
@@ -134,17 +1397,48 @@ class SubcommandHandle;
 
 class Parser {
 public:
-    Parser(const std::string& description = ""):
+    // Item strings, choices and lookup tables are allocated from an arena
+    // drawing large blocks from memory, and freed together with the parser
+    Parser(const std::string& description = "", std::pmr::memory_resource* memory = std::pmr::get_default_resource()):
+        arena(arena_block_size, memory),
         description(description),
+        schema(nullptr),
         subcommand_required(false)
     {}
 
+    template <FixedString... Identifiers>
+    Parser(
+        const Schema<Identifiers...>&,
+        const std::string& description = "",
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource()
+    ):
+        arena(arena_block_size, memory),
+        description(description),
+        schema(&Schema<Identifiers...>::view),
+        subcommand_required(false)
+    {
+        items.reserve(Schema<Identifiers...>::size);
+    }
+
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
+
     template <is_output_t T>
     ItemHandle<T> add(T& output, const std::string& identifier) {
+        check_modifiable();
         Item item;
         item.output = &output;
-        item.identifier = identifier;
-        item.type = parse_identifier(item.identifier);
+        item.ops = &detail::output_ops<T>;
+        item.choices = &no_choices;
+        if constexpr(is_list_t<T>) {
+            item.kind = OutputKind::List;
+        } else {
+            item.kind = std::is_same_v<T, bool> ? OutputKind::Flag : OutputKind::Value;
+        }
+        item.requires_choice_values = is_enum_output<T>;
+        item.is_view_list = is_view_list_t<T>;
+        item.identifier = intern(identifier);
+        item.type = schema ? schema_identifier(item.identifier) : parse_identifier(item.identifier);
         item.is_optional = is_optional_t<T>;
         item.has_default = is_optional_t<T>;
 
@@ -155,46 +1449,253 @@ public:
             }
             output = false;
         }
-        if constexpr(std::is_same_v<T, std::vector<std::string>>) {
-            output.clear();
+        if constexpr(is_list_t<T>) {
+            output = T();
         }
 
+        help_cache.invalidate();
         items.push_back(item);
-        return ItemHandle(&output, &items.back());
+        return ItemHandle(&output, this, items.size() - 1);
     }
 
     template <typename OutputT>
     SubcommandHandle<OutputT> subcommand(OutputT& output);
 
-    [[nodiscard]] bool parse(int argc, const char** argv) const {
-        if (!parse(argv[0], std::span<const char*>(argv+1, argc-1))) {
-            return false;
-        }
-        return true;
+    // Besides parsing, two hidden commands support shell completion:
+    //   program __complete bash|zsh|fish
+    //     writes a script which registers completion for the program
+    //   program __complete -- <words> <partial word>
+    //     writes the candidates for the partial word, one per line
+    // Both write to ParseOptions::output and return false.
+    // Failures are written to ParseOptions::output, unless
+    // ParseOptions::result is given to record them instead.
+    [[nodiscard]] bool parse(int argc, const char** argv, const ParseOptions& options = {}) const {
+        return parse_argv(argc, argv, options, {});
+    }
+
+    // Validates the structure of the items once, throwing UsageError if
+    // invalid, and builds lookup tables so that parse() only does per-word
+    // work. The parser can't be modified afterwards.
+    // Subcommand parsers are finalized automatically.
+    void finalize();
+
+    bool finalized() const {
+        return layout.has_value();
+    }
+
+    // Number of words needed in ParseOptions::scratch
+    std::size_t scratch_size() const {
+        return 2 * ((items.size() + 63) / 64);
     }
 
 private:
-    [[nodiscard]] bool parse(const std::string& program, const std::span<const char*>& words) const;
-    std::string help_message(const std::string& program) const;
-    ItemType parse_identifier(const std::string& identifier);
+    bool parse_argv(
+        int argc,
+        const char** argv,
+        const ParseOptions& options,
+        const Relocation& relocation) const;
+    [[nodiscard]] bool parse(
+        std::string_view program,
+        const std::span<const char*>& words,
+        const ParseOptions& options,
+        ParseResult& result,
+        const Relocation& relocation = {}) const;
+    void validate() const;
+    // Throws UsageError if an item or the subcommand is bound outside
+    // [begin, begin + size), as it would be shared by every parse into a
+    // copy of that range
+    void check_outputs_within(const void* begin, std::size_t size) const;
+    bool is_list(std::size_t item_i) const;
+    // Contribution of an item's current value to a fingerprint
+    Fingerprint item_fingerprint(std::size_t item_i, const Relocation& relocation) const;
+    void check_modifiable() const {
+        if (layout.has_value()) {
+            throw UsageError("Cannot modify a parser after it is finalized");
+        }
+    }
+    Item& modify_item(std::size_t item_i) {
+        check_modifiable();
+        help_cache.invalidate();
+        return items[item_i];
+    }
+    std::string_view intern(std::string_view text) {
+        if (text.empty()) {
+            return {};
+        }
+        char* data = static_cast<char*>(arena.allocate(text.size(), 1));
+        std::copy(text.begin(), text.end(), data);
+        return std::string_view(data, text.size());
+    }
+    // Arena arrays are never destroyed, only freed with the arena
+    template <typename T>
+    requires std::is_trivially_destructible_v<T>
+    std::span<T> allocate(std::size_t size) {
+        T* data = static_cast<T*>(arena.allocate(size * sizeof(T), alignof(T)));
+        std::uninitialized_value_construct_n(data, size);
+        return std::span<T>(data, size);
+    }
+    const Choices* make_choices(std::span<const std::string_view> names, std::span<const std::int64_t> values);
+    std::optional<std::span<const char*>> argv_words(
+        int argc,
+        const char** argv,
+        const ParseOptions& options,
+        ParseResult& result) const;
+    void write_message(
+        std::string_view program,
+        const std::string& message,
+        bool show_help,
+        const ParseOptions& options) const;
+    ParseError parse_value(
+        const Item& item,
+        std::string_view word,
+        const Relocation& relocation,
+        std::string& error) const;
+    bool apply_config(
+        const ConfigFile& config,
+        const Relocation& relocation,
+        std::span<std::uint64_t> item_has_config,
+        Fingerprint* fingerprint,
+        std::string& error) const;
+    std::string help_message(std::string_view program) const;
+    void complete_command(int argc, const char** argv, const ParseOptions& options) const;
+    void complete(std::span<const char*> words, std::string& output) const;
+    ItemType parse_identifier(std::string_view identifier);
+    ItemType schema_identifier(std::string_view identifier);
+    std::optional<std::size_t> find_flag(std::string_view word) const;
+    // Calls visitor(name) for each flag alias
+    template <typename Visitor>
+    void for_each_flag(Visitor&& visitor) const {
+        if (layout || schema) {
+            for (std::string_view key: layout ? layout->flags.keys : schema->flags.keys) {
+                visitor(key);
+            }
+            return;
+        }
+        for (const auto& [key, item_i]: flags) {
+            visitor(key);
+        }
+    }
 
+    static constexpr std::size_t inline_scratch_size = 8;
+    static constexpr std::size_t arena_block_size = 16384;
+
+    // Tables built by finalize() for the parse hot path, in the arena
+    struct Layout {
+        // Bit per item
+        std::span<std::uint64_t> has_default;
+        std::span<std::uint64_t> is_list;
+        // Items with an environment variable
+        std::span<std::size_t> env_items;
+        // Items with a list output which refers to its words
+        std::span<std::size_t> view_list_items;
+        FlagTable flags;
+        // Hasher for each item which has already added its identifier
+        std::span<detail::FingerprintHasher> item_hashers;
+        // Contribution of each item's default value to a fingerprint, and
+        // their sum
+        std::span<Fingerprint> default_fingerprints;
+        Fingerprint defaults_fingerprint;
+        // Item which can't be fingerprinted, if any
+        std::optional<std::size_t> unhashable_item;
+    };
+
+    // Only holds what is never freed or resized until the parser is: the
+    // strings, choices and tables. The arena never frees, so containers which
+    // grow use the normal allocator rather than keeping each outgrown buffer.
+    std::pmr::monotonic_buffer_resource arena;
     const std::string description;
+    const SchemaView* schema;
     std::vector<Item> items;
-    std::unordered_map<std::string, std::size_t> flags;
+    // Keys refer to the identifiers in the arena
+    std::unordered_map<std::string_view, std::size_t, detail::StringHash, std::equal_to<>> flags;
     std::vector<std::size_t> args;
     std::vector<Subcommand> subcommands;
+    const void* subcommand_output = nullptr;
+    std::unordered_map<std::string, std::size_t, detail::StringHash, std::equal_to<>> subcommand_index;
     bool subcommand_required;
+    // Words following the program name that select this parser, eg: " remote add"
+    std::string command_path;
+    HelpCache help_cache;
+    std::optional<Layout> layout;
 
     template <typename OutputT>
     friend class SubcommandHandle;
+    template <typename ArgsT>
+    friend class ArgsParser;
+    friend struct ParseResult;
+    template <typename T>
+    friend class ItemHandle;
 };
 
+template <typename T>
+Item& ItemHandle<T>::item() {
+    return parser->modify_item(index);
+}
+
+template <typename T>
+ItemHandle<T>& ItemHandle<T>::choices(const std::vector<std::string>& choices)
+requires (!is_enum_output<T>)
+{
+    if (choices.empty()) {
+        throw UsageError("Choices cannot be empty");
+    }
+    Item& item = this->item();
+    auto names = parser->allocate<std::string_view>(choices.size());
+    for (std::size_t i = 0; i < choices.size(); i++) {
+        names[i] = parser->intern(choices[i]);
+    }
+    item.choices = parser->make_choices(names, {});
+    if constexpr(is_list_stream<T>) {
+        output->choices = *item.choices;
+    }
+    return *this;
+}
+
+template <typename T>
+template <typename S>
+requires requires { typename choice_value<S>::type; }
+ItemHandle<T>& ItemHandle<T>::choices(std::initializer_list<std::pair<std::string, typename choice_value<S>::type>> choices) {
+    if (choices.size() == 0) {
+        throw UsageError("Choices cannot be empty");
+    }
+    Item& item = this->item();
+    auto names = parser->allocate<std::string_view>(choices.size());
+    auto values = parser->allocate<std::int64_t>(choices.size());
+    std::size_t i = 0;
+    for (const auto& [name, value]: choices) {
+        names[i] = parser->intern(name);
+        values[i] = static_cast<std::int64_t>(value);
+        i++;
+    }
+    item.choices = parser->make_choices(names, values);
+    if constexpr(is_list_stream<T>) {
+        output->choices = *item.choices;
+    }
+    return *this;
+}
+
+template <typename T>
+ItemHandle<T>& ItemHandle<T>::help(const std::string& help) {
+    Item& item = this->item();
+    item.help = parser->intern(help);
+    return *this;
+}
+
+template <typename T>
+ItemHandle<T>& ItemHandle<T>::env(const std::string& name)
+requires (!is_list_t<T>)
+{
+    Item& item = this->item();
+    item.env = parser->intern(name);
+    return *this;
+}
+
 template <typename OutputT>
 class SubcommandHandle {
 public:
-    SubcommandHandle(OutputT& output, std::vector<Subcommand>& subcommands):
+    SubcommandHandle(OutputT& output, Parser& parser):
         output(&output),
-        subcommands(&subcommands)
+        parser(&parser)
     {}
     template <typename ArgsT, typename ...ConstructorArgs>
     requires std::is_base_of_v<Args, ArgsT> && std::convertible_to<ArgsT, OutputT>
@@ -203,39 +1704,276 @@ public:
         const std::string& description = "",
         const ConstructorArgs&... constructor_args)
     {
+        parser->check_modifiable();
+        if (parser->subcommand_index.contains(name)) {
+            throw UsageError("Duplicate subcommand '" + name + "'");
+        }
+
+        // The subcommand parser is built on first use and then kept, bound to
+        // a default-initialised instance of the args. Each dispatch parses
+        // into a copy of these, so concurrent dispatches don't share state.
+        struct Node {
+            std::string command_path;
+            std::once_flag built;
+            std::once_flag checked;
+            std::optional<ArgsT> defaults;
+            std::optional<Parser> parser;
+        };
+        auto node = std::make_shared<Node>();
+        node->command_path = parser->command_path + " " + name;
+
+        // Subcommand parsers have their own arena, from the same memory
+        std::pmr::memory_resource* memory = parser->arena.upstream_resource();
+        auto build = [node, memory, constructor_args...](ParseStats* stats) -> const Parser& {
+            std::call_once(node->built, [&]() {
+                detail::StatsTimer timer(stats, &ParseStats::subcommand_build);
+                node->parser.emplace("", memory);
+                node->parser->command_path = node->command_path;
+                node->defaults.emplace(constructor_args...);
+                ((Args&)node->defaults.value()).build(node->parser.value());
+                node->parser->finalize();
+            });
+            return node->parser.value();
+        };
+
         OutputT* captured_output = output;
         Subcommand subcommand;
         subcommand.name = name;
         subcommand.description = description;
         subcommand.callback =
-            [captured_output, name, constructor_args...](
-                const std::string& program,
-                std::span<const char*> words)
+            [captured_output, node, build](
+                std::string_view program,
+                std::span<const char*> words,
+                const ParseOptions& options,
+                ParseResult& result,
+                const Relocation& relocation)
             {
-                ArgsT args(constructor_args...);
-                Parser parser;
-                ((Args&)args).build(parser);
-                if (!parser.parse(program + " " + name, words)) {
+                build(options.stats);
+                // Outputs outside the args are written directly, unless the
+                // parse started from an ArgsParser
+                if (relocation.outputs_within) {
+                    std::call_once(node->checked, [&]() {
+                        node->parser->check_outputs_within(&node->defaults.value(), sizeof(ArgsT));
+                    });
+                }
+                ArgsT args = node->defaults.value();
+                Relocation args_relocation{ &node->defaults.value(), &args, sizeof(ArgsT), relocation.outputs_within };
+                if (!node->parser->parse(program, words, options, result, args_relocation)) {
                     return false;
                 }
-                *captured_output = args;
+                *relocation.apply(captured_output) = args;
                 return true;
             };
-        subcommands->push_back(subcommand);
+        subcommand.parser = [build]() -> const Parser& {
+            return build(nullptr);
+        };
+        parser->help_cache.invalidate();
+        parser->subcommand_index.emplace(name, parser->subcommands.size());
+        parser->subcommands.push_back(subcommand);
         return *this;
     }
 private:
     OutputT* output;
-    std::vector<Subcommand>* subcommands;
+    Parser* parser;
 };
 
 template <typename OutputT>
 SubcommandHandle<OutputT> Parser::subcommand(OutputT& output) {
+    check_modifiable();
     if (!subcommands.empty()) {
         throw UsageError("Cannot call subcommand twice");
     }
+    help_cache.invalidate();
+    subcommand_output = &output;
     subcommand_required = !is_optional<OutputT>;
-    return SubcommandHandle<OutputT>(output, subcommands);
+    return SubcommandHandle<OutputT>(output, *this);
+}
+
+// Parser bound to the members of ArgsT rather than to fixed variables.
+// Once built, a single ArgsParser can parse into any number of ArgsT objects,
+// including concurrently from multiple threads.
+// Items are bound either with pointers to members, or with ArgsT::build if
+// ArgsT derives from Args.
+template <typename ArgsT>
+class ArgsParser {
+public:
+    ArgsParser(const std::string& description = ""):
+        parser(description)
+    {
+        // Members added later are always inside defaults, but build() may
+        // bind anything
+        if constexpr(std::is_base_of_v<Args, ArgsT>) {
+            ((Args&)defaults).build(parser);
+            parser.check_outputs_within(&defaults, sizeof(ArgsT));
+        }
+    }
+    ArgsParser(const ArgsParser&) = delete;
+    ArgsParser& operator=(const ArgsParser&) = delete;
+
+    template <is_output_t T>
+    ItemHandle<T> add(T ArgsT::* member, const std::string& identifier) {
+        return parser.add(defaults.*member, identifier);
+    }
+
+    template <typename OutputT>
+    SubcommandHandle<OutputT> subcommand(OutputT ArgsT::* member) {
+        return parser.subcommand(defaults.*member);
+    }
+
+    void finalize() {
+        parser.finalize();
+    }
+
+    // Values of the result before parsing
+    const ArgsT& default_args() const {
+        return defaults;
+    }
+
+    // Resets result to the default values, then parses into it
+    [[nodiscard]] bool parse(int argc, const char** argv, ArgsT& result, const ParseOptions& options = {}) const {
+        result = defaults;
+        Relocation relocation{ &defaults, &result, sizeof(ArgsT), true };
+        return parser.parse_argv(argc, argv, options, relocation);
+    }
+
+    // Calls callback from reparse() when the item bound to member changes
+    template <typename T>
+    void on_change(T ArgsT::* member, std::function<void(const ArgsT& args)> callback) {
+        const void* output = &(defaults.*member);
+        for (std::size_t i = 0; i < parser.items.size(); i++) {
+            if (parser.items[i].output == output) {
+                change_callbacks.emplace_back(i, std::move(callback));
+                return;
+            }
+        }
+        throw UsageError("No item is bound to the member");
+    }
+
+    // Parses into a copy of the defaults, then assigns only the items of
+    // current whose values differ, so that an unchanged setting is never
+    // written. Once all are assigned, calls the change callbacks of the
+    // changed items. Returns their identifiers in the order they were added,
+    // or nullopt if parsing failed, leaving current unchanged.
+    // Items without == are always assigned and reported as changed.
+    std::optional<std::vector<std::string_view>> reparse(
+        int argc,
+        const char** argv,
+        ArgsT& current,
+        const ParseOptions& options = {}) const
+    {
+        if (!parser.subcommands.empty()) {
+            throw UsageError("Cannot reparse a parser with subcommands");
+        }
+        ArgsT staged = defaults;
+        if (!parse(argc, argv, staged, options)) {
+            return std::nullopt;
+        }
+
+        Relocation to_staged{ &defaults, &staged, sizeof(ArgsT) };
+        Relocation to_current{ &defaults, &current, sizeof(ArgsT) };
+        std::vector<std::size_t> changed_items;
+        for (std::size_t i = 0; i < parser.items.size(); i++) {
+            const Item& item = parser.items[i];
+            const void* value = to_staged.apply(item.output);
+            void* output = to_current.apply(item.output);
+            if (item.ops->equal && item.ops->equal(value, output)) {
+                continue;
+            }
+            item.ops->copy(value, output);
+            changed_items.push_back(i);
+        }
+
+        std::vector<std::string_view> changed;
+        changed.reserve(changed_items.size());
+        for (std::size_t item_i: changed_items) {
+            changed.push_back(parser.items[item_i].identifier);
+            for (const auto& [callback_item, callback]: change_callbacks) {
+                if (callback_item == item_i) {
+                    callback(current);
+                }
+            }
+        }
+        return changed;
+    }
+
+private:
+    ArgsT defaults;
+    Parser parser;
+    std::vector<std::pair<std::size_t, std::function<void(const ArgsT&)>>> change_callbacks;
+};
+
+// Reads command lines, one per line, from a file descriptor or from the
+// connections to a Unix socket, and runs each one. Lines are split with
+// shell-style quoting, as by tokenize(), and blank lines are ignored. The
+// reply to each line is one line of JSON:
+//   {"ok": true, "status": 0, "output": "..."}
+// where ok is false if the line couldn't be tokenized or parsed, status is
+// the command's result or null, and output is everything written to its sink,
+// including parse errors and help.
+class CommandServer {
+public:
+    // Runs argv, which starts with the program name. Returns nullopt if the
+    // arguments couldn't be parsed.
+    using command_t = std::function<std::optional<int>(int argc, const char** argv, const Sink& output)>;
+
+    CommandServer(const std::string& program, command_t command);
+    CommandServer(const CommandServer&) = delete;
+    CommandServer& operator=(const CommandServer&) = delete;
+
+    // Lines longer than this end the connection, after an error reply
+    static constexpr std::size_t max_line_size = 1 << 20;
+
+    // Serves command lines from in until end of file, writing replies to out.
+    // Replies to the lines from each read are written together.
+    bool serve(int in, int out);
+    // Creates a Unix socket at path, replacing a stale socket left there, and
+    // serves each connection in turn. A connection which sends nothing, or
+    // doesn't read its replies, for the connection timeout is closed, so one
+    // idle client can't hold up the others. Only returns on error, after
+    // removing the socket.
+    bool listen(const std::string& path);
+    // Defaults to 10 seconds
+    void set_connection_timeout(std::chrono::milliseconds timeout) {
+        connection_timeout = timeout;
+    }
+    // Runs one command line, appending its reply to reply
+    void run(std::string_view line, std::string& reply);
+
+    const std::string& error() const {
+        return error_message;
+    }
+
+private:
+    std::string program;
+    command_t command;
+    // Reused for each line
+    std::string line;
+    std::vector<const char*> words;
+    std::string output;
+    Sink sink;
+    std::chrono::milliseconds connection_timeout{10000};
+    std::string error_message;
+};
+
+// Command server which parses each command line with parser, built once,
+// and passes the result to handler. The server refers to parser, which must
+// outlive it.
+template <typename ArgsT>
+CommandServer command_server(
+    const ArgsParser<ArgsT>& parser,
+    const std::string& program,
+    std::function<int(const ArgsT& args, const Sink& output)> handler)
+{
+    auto result = std::make_shared<ArgsT>(parser.default_args());
+    return CommandServer(program,
+        [&parser, result, handler](int argc, const char** argv, const Sink& output) -> std::optional<int> {
+            ParseOptions options;
+            options.output = output;
+            if (!parser.parse(argc, argv, *result, options)) {
+                return std::nullopt;
+            }
+            return handler(*result, output);
+        });
 }
 
 [[nodiscard]] inline bool parse(int argc, const char** argv, Args& args, const std::string& description = "")  {
@@ -1,83 +1,185 @@
 #include "argparse.hpp"
+
+#include <bit>
 #include <sstream>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
 
 namespace argparse {
 
-bool parse_word(
-    const std::string& word,
-    const std::vector<std::string>& choices,
-    int& value)
-{
-    try {
-        value = std::stoi(word);
-        return true;
-    } catch (const std::invalid_argument&) {
-        std::cout << "Invalid integer argument '" << word << "'\n";
-        return false;
+// Collects the closest candidates to a misspelt word, for "did you mean"
+// suggestions. Distances are computed with Myers' bit-parallel algorithm,
+// one machine word per column, and candidates beyond a bound are abandoned
+// early, so checking thousands of candidates takes microseconds.
+class Suggestions {
+public:
+    explicit Suggestions(std::string_view word):
+        word(word),
+        max_distance(distance_bound(word))
+    {
+        if (word.empty() || word.size() > 64) {
+            return;
+        }
+        peq.fill(0);
+        for (std::size_t i = 0; i < word.size(); i++) {
+            peq[static_cast<unsigned char>(word[i])] |= std::uint64_t(1) << i;
+        }
     }
-}
 
-bool parse_word(
-    const std::string& word,
-    const std::vector<std::string>& choices,
-    std::optional<int>& value)
-{
-    value.emplace();
-    return parse_word(word, choices, value.value());
+    void add(std::string_view candidate) {
+        if (word.empty() || word.size() > 64) {
+            return;
+        }
+        auto distance = edit_distance(candidate);
+        if (!distance.has_value()) {
+            return;
+        }
+        std::pair<std::size_t, std::string_view> entry(distance.value(), candidate);
+        auto position = std::lower_bound(best.begin(), best.end(), entry);
+        best.insert(position, entry);
+        if (best.size() > max_suggestions) {
+            best.pop_back();
+        }
+        // Only candidates at least as close as the current ones can be kept
+        if (best.size() == max_suggestions) {
+            max_distance = best.back().first;
+        }
+    }
+
+    // eg: ", did you mean '--verbose'?", or empty if nothing was close
+    std::string message() const {
+        if (best.empty()) {
+            return "";
+        }
+        std::string message = ", did you mean ";
+        for (std::size_t i = 0; i < best.size(); i++) {
+            if (i != 0) {
+                message += i + 1 == best.size() ? " or " : ", ";
+            }
+            message += "'" + std::string(best[i].second) + "'";
+        }
+        return message + "?";
+    }
+
+private:
+    static constexpr std::size_t max_suggestions = 3;
+
+    // A third of the word's length, from 1 to 3, not counting the dashes of
+    // a flag. A candidate which differs in every character isn't a
+    // suggestion, so the bound is below that length, and 0 for "-x".
+    static std::size_t distance_bound(std::string_view word) {
+        std::size_t name_size = word.size() - std::min(word.find_first_not_of('-'), word.size());
+        std::size_t bound = std::clamp<std::size_t>(name_size / 3, 1, 3);
+        return std::min(bound, name_size == 0 ? 0 : name_size - 1);
+    }
+
+    // Levenshtein distance from word to text, or nullopt if more than
+    // max_distance
+    std::optional<std::size_t> edit_distance(std::string_view text) const {
+        std::size_t m = word.size();
+        std::size_t n = text.size();
+        if ((m > n ? m - n : n - m) > max_distance) {
+            return std::nullopt;
+        }
+        const std::uint64_t last = std::uint64_t(1) << (m - 1);
+        std::uint64_t pv = ~std::uint64_t(0);
+        std::uint64_t mv = 0;
+        std::size_t score = m;
+        for (std::size_t j = 0; j < n; j++) {
+            std::uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+            std::uint64_t xv = eq | mv;
+            std::uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            std::uint64_t ph = mv | ~(xh | pv);
+            std::uint64_t mh = pv & xh;
+            if (ph & last) {
+                score++;
+            } else if (mh & last) {
+                score--;
+            }
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            // Each remaining character can lower the distance by at most one
+            if (score > max_distance + (n - j - 1)) {
+                return std::nullopt;
+            }
+        }
+        return score;
+    }
+
+    std::string_view word;
+    std::size_t max_distance;
+    std::array<std::uint64_t, 256> peq;
+    std::vector<std::pair<std::size_t, std::string_view>> best;
+};
+
+std::string detail::invalid_choice(std::string_view word, const Choices& choices) {
+    Suggestions suggestions(word);
+    for (const auto& name: choices.names) {
+        suggestions.add(name);
+    }
+    return "Invalid value '" + std::string(word) + "', not a valid choice" + suggestions.message();
 }
 
-bool parse_word(
-    const std::string& word,
-    const std::vector<std::string>& choices,
-    double& value)
-{
-    try {
-        value = std::stod(word);
+template <is_number_t T>
+bool value_parser<T>::parse(std::string_view word, T& value, std::string& error) {
+    constexpr const char* kind = std::is_integral_v<T> ? "integer" : "number";
+    const char* begin = word.data();
+    const char* end = word.data() + word.size();
+    // from_chars doesn't accept an explicit '+'
+    if (begin != end && *begin == '+' && (end - begin == 1 || begin[1] != '-')) {
+        begin++;
+    }
+    auto [ptr, ec] = std::from_chars(begin, end, value);
+    if (ec == std::errc() && ptr == end) {
         return true;
-    } catch (const std::invalid_argument&) {
-        std::cout << "Invalid integer argument '" << word << "'\n";
-        return false;
     }
+    // Built in place, so a reused error string doesn't allocate
+    error.assign(ec == std::errc::result_out_of_range ? "Out of range " : "Invalid ");
+    error.append(kind);
+    error.append(" argument '");
+    error.append(word);
+    error.append("'");
+    return false;
 }
 
-bool parse_word(
-    const std::string& word,
-    const std::vector<std::string>& choices,
-    std::optional<double>& value)
-{
-    value.emplace();
-    return parse_word(word, choices, value.value());
-}
+template struct value_parser<int>;
+template struct value_parser<long>;
+template struct value_parser<long long>;
+template struct value_parser<unsigned int>;
+template struct value_parser<unsigned long>;
+template struct value_parser<unsigned long long>;
+template struct value_parser<float>;
+template struct value_parser<double>;
 
-bool parse_word(
-    const std::string& word,
-    const std::vector<std::string>& choices,
-    std::string& value)
-{
-    if (!choices.empty()) {
-        auto iter = std::find(choices.begin(), choices.end(), word);
-        if (iter == choices.end()) {
-            std::cout << "Invalid value '" << word << "', not a valid choice\n";
-            return false;
-        }
-    }
+bool value_parser<std::string>::parse(std::string_view word, std::string& value, std::string&) {
     value = word;
     return true;
 }
 
-bool parse_word(
-    const std::string& word,
-    const std::vector<std::string>& choices,
-    std::optional<std::string>& value)
-{
-    value.emplace();
-    return parse_word(word, choices, value.value());
+bool value_parser<bool>::parse(std::string_view word, bool& value, std::string& error) {
+    if (word == "1" || word == "true" || word == "yes" || word == "on") {
+        value = true;
+        return true;
+    }
+    if (word == "0" || word == "false" || word == "no" || word == "off") {
+        value = false;
+        return true;
+    }
+    error.assign("Invalid boolean value '");
+    error.append(word);
+    error.append("'");
+    return false;
 }
 
-bool Parser::parse(
-    const std::string& program,
-    const std::span<const char*>& words) const
-{
+void Parser::validate() const {
+    if (schema && items.size() != schema->identifiers.size()) {
+        throw UsageError("Not all items in the schema were added");
+    }
+
     bool have_list_arg = false;
     bool have_optional_arg = false;
     for (const auto& item: items) {
@@ -89,146 +191,668 @@ bool Parser::parse(
         if (have_list_arg) {
             throw UsageError("List argument must be the final argument");
         }
-        if (std::get_if<std::vector<std::string>*>(&item.output)) {
+        if (item.kind == OutputKind::List) {
             have_list_arg = true;
             continue;
         }
     }
+    for (const auto& item: items) {
+        if (item.requires_choice_values && !item.choices->has_values()) {
+            throw UsageError("Enum item '" + std::string(item.identifier) + "' requires choices");
+        }
+    }
     if (have_optional_arg && !subcommands.empty()) {
         throw UsageError("Cannot have an optional arg and subcommands");
     }
     if (have_list_arg && !subcommands.empty()) {
         throw UsageError("Cannot have a list arg and subcommands");
     }
+}
+
+void Parser::check_outputs_within(const void* begin, std::size_t size) const {
+    auto is_within = [&](const void* output) {
+        return reinterpret_cast<std::uintptr_t>(output) - reinterpret_cast<std::uintptr_t>(begin) < size;
+    };
+    for (const auto& item: items) {
+        if (!is_within(item.output)) {
+            throw UsageError("Item '" + std::string(item.identifier) + "' must be bound to a member of the args");
+        }
+    }
+    if (subcommand_output && !is_within(subcommand_output)) {
+        throw UsageError("Subcommand must be bound to a member of the args");
+    }
+}
+
+static UsageError unhashable_item(const Item& item) {
+    return UsageError("Item '" + std::string(item.identifier) + "' has a type which can't be fingerprinted");
+}
+
+static Fingerprint value_fingerprint(const Item& item, detail::FingerprintHasher hasher, const void* output) {
+    item.ops->hash(hasher, output);
+    return hasher.finish();
+}
+
+void Parser::finalize() {
+    if (layout) {
+        return;
+    }
+    validate();
+
+    Layout built;
+    std::size_t words = (items.size() + 63) / 64;
+    built.has_default = allocate<std::uint64_t>(words);
+    built.is_list = allocate<std::uint64_t>(words);
+    std::size_t num_env_items = 0;
+    std::size_t num_view_list_items = 0;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        const Item& item = items[i];
+        if (item.has_default) {
+            built.has_default[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+        if (item.kind == OutputKind::List) {
+            built.is_list[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+        num_env_items += !item.env.empty();
+        num_view_list_items += item.is_view_list;
+    }
+    built.env_items = allocate<std::size_t>(num_env_items);
+    built.view_list_items = allocate<std::size_t>(num_view_list_items);
+    for (std::size_t i = 0, env_i = 0, view_list_i = 0; i < items.size(); i++) {
+        if (!items[i].env.empty()) {
+            built.env_items[env_i++] = i;
+        }
+        if (items[i].is_view_list) {
+            built.view_list_items[view_list_i++] = i;
+        }
+    }
+
+    // Each item's identifier is hashed once here rather than on each parse
+    built.item_hashers = allocate<detail::FingerprintHasher>(items.size());
+    built.default_fingerprints = allocate<Fingerprint>(items.size());
+    for (std::size_t i = 0; i < items.size(); i++) {
+        detail::FingerprintHasher& hasher = built.item_hashers[i];
+        hasher.add(std::uint64_t(0));
+        hasher.add(command_path);
+        hasher.add(items[i].identifier);
+        if (!items[i].ops->hash) {
+            built.unhashable_item = built.unhashable_item.value_or(i);
+            continue;
+        }
+        built.default_fingerprints[i] = value_fingerprint(items[i], hasher, items[i].output);
+        built.defaults_fingerprint += built.default_fingerprints[i];
+    }
+
+    if (schema) {
+        built.flags = schema->flags;
+    } else if (!flags.empty()) {
+        auto keys = allocate<std::string_view>(flags.size());
+        auto key_items = allocate<std::size_t>(flags.size());
+        auto displacements = allocate<std::uint32_t>(detail::perfect_hash_buckets(flags.size()));
+        auto slots = allocate<std::uint32_t>(detail::perfect_hash_slots(flags.size()));
+        std::vector<std::uint64_t> hashes;
+        hashes.reserve(flags.size());
+        std::size_t key_i = 0;
+        for (const auto& [name, item_i]: flags) {
+            keys[key_i] = name;
+            key_items[key_i] = item_i;
+            hashes.push_back(detail::hash_word(name));
+            key_i++;
+        }
+        if (!detail::build_perfect_hash(hashes, displacements, slots)) {
+            throw UsageError("Failed to build perfect hash for flags");
+        }
+        built.flags = FlagTable{ displacements, slots, keys, key_items };
+    }
+    layout.emplace(built);
+
+    // The flag table replaces the map, and no more items can be added
+    flags = decltype(flags)();
+    items.shrink_to_fit();
+    args.shrink_to_fit();
+}
+
+const Choices* Parser::make_choices(std::span<const std::string_view> names, std::span<const std::int64_t> values) {
+    // Duplicates would never fit in the perfect hash, so find them first
+    std::vector<std::uint64_t> hashes(names.size());
+    for (std::size_t i = 0; i < names.size(); i++) {
+        hashes[i] = detail::hash_word(names[i]);
+    }
+    std::vector<std::size_t> order(names.size());
+    for (std::size_t i = 0; i < names.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t lhs, std::size_t rhs) {
+        return hashes[lhs] < hashes[rhs];
+    });
+    for (std::size_t i = 1; i < order.size(); i++) {
+        if (hashes[order[i]] == hashes[order[i - 1]] && names[order[i]] == names[order[i - 1]]) {
+            throw UsageError("Duplicate choice '" + std::string(names[order[i]]) + "'");
+        }
+    }
+
+    Choices& choices = allocate<Choices>(1)[0];
+    choices.names = names;
+    choices.values = values;
+    auto displacements = allocate<std::uint32_t>(detail::perfect_hash_buckets(names.size()));
+    auto slots = allocate<std::uint32_t>(detail::perfect_hash_slots(names.size()));
+    if (!detail::build_perfect_hash(hashes, displacements, slots)) {
+        throw UsageError("Failed to build perfect hash for choices");
+    }
+    choices.displacements = displacements;
+    choices.slots = slots;
+    return &choices;
+}
+
+bool Parser::parse_argv(
+    int argc,
+    const char** argv,
+    const ParseOptions& options,
+    const Relocation& relocation) const
+{
+    if (options.fingerprint) {
+        *options.fingerprint = {};
+    }
+    ParseResult local_result;
+    ParseResult& result = options.result ? *options.result : local_result;
+    result.error = ParseError::None;
+    result.word_index.reset();
+    result.word = {};
+    result.item = nullptr;
+    result.parser = this;
+    result.program = argv[0];
+    result.reason.clear();
+
+    auto words = argv_words(argc, argv, options, result);
+    if (words.has_value() && parse(argv[0], words.value(), options, result, relocation)) {
+        return true;
+    }
+    if (!options.result && result.error != ParseError::Completion) {
+        result.parser->write_message(result.program, result.message(), result.shows_help(), options);
+    }
+    return false;
+}
+
+bool Parser::parse(
+    std::string_view program,
+    const std::span<const char*>& words,
+    const ParseOptions& options,
+    ParseResult& result,
+    const Relocation& relocation) const
+{
+    detail::StatsScope stats_scope(options.stats, words.size());
+    if (!layout) {
+        detail::StatsTimer timer(options.stats, &ParseStats::validation);
+        validate();
+    }
 
     std::size_t word_i = 0;
     std::size_t arg_i = 0; // Positional argument
     std::vector<Subcommand>::const_iterator subcommand = subcommands.end();
 
-    std::vector<bool> item_has_value;
-    for (const auto& item: items) {
-        item_has_value.push_back(item.has_default);
+    // Per-item bits recording whether a value was given in argv, and whether
+    // one was given in the config file. Small parsers use a fixed-size buffer
+    // on the stack, larger parsers use the caller's scratch buffer if provided.
+    std::array<std::uint64_t, inline_scratch_size> inline_scratch;
+    std::vector<std::uint64_t> heap_scratch;
+    std::span<std::uint64_t> item_state;
+    if (scratch_size() <= inline_scratch.size()) {
+        item_state = std::span(inline_scratch).first(scratch_size());
+    } else if (options.scratch.size() >= scratch_size()) {
+        item_state = options.scratch.first(scratch_size());
+    } else {
+        heap_scratch.resize(scratch_size());
+        item_state = heap_scratch;
+    }
+    std::fill(item_state.begin(), item_state.end(), 0);
+    auto item_has_value = item_state.first(item_state.size() / 2);
+    auto item_has_config = item_state.last(item_state.size() / 2);
+    auto set_bit = [](std::span<std::uint64_t> bits, std::size_t i) {
+        bits[i / 64] |= std::uint64_t(1) << (i % 64);
+    };
+    auto get_bit = [](std::span<const std::uint64_t> bits, std::size_t i) {
+        return (bits[i / 64] >> (i % 64)) & 1;
+    };
+
+    // Records a failure, without formatting its message
+    auto fail = [&](ParseError error, std::optional<std::size_t> fail_word_i, const Item* item = nullptr) {
+        result.error = error;
+        result.word_index = fail_word_i;
+        if (fail_word_i.has_value()) {
+            result.word = words[fail_word_i.value()];
+        }
+        result.item = item;
+        result.parser = this;
+        return false;
+    };
+
+    // Lists which refer to their words are emptied, and a ListStream reads
+    // its input, unless given words this time, so that none refer to the
+    // words of a previous parse, which may no longer exist
+    auto reset_view_list = [&](const Item& item) {
+        item.ops->assign_list({}, relocation.apply(item.output), *item.choices, result.reason, 1);
+    };
+    if (layout) {
+        for (std::size_t i: layout->view_list_items) {
+            reset_view_list(items[i]);
+        }
+    } else {
+        for (const Item& item: items) {
+            if (item.is_view_list) reset_view_list(item);
+        }
+    }
+
+    // Every item not given a value keeps its default, so the fingerprint
+    // starts from their sum. As each value is written, the contribution of
+    // the value it replaces, the default or one given earlier in this parse,
+    // is swapped for the new one.
+    Fingerprint* fingerprint = options.fingerprint;
+    if (fingerprint) {
+        if (!layout || relocation.size == 0) {
+            throw UsageError("Fingerprints require parsing into a copy of the defaults with a finalized parser, eg: by ArgsParser after finalize()");
+        }
+        if (layout->unhashable_item.has_value()) {
+            throw unhashable_item(items[layout->unhashable_item.value()]);
+        }
+        *fingerprint += layout->defaults_fingerprint;
+    }
+    auto unhash_value = [&](std::size_t i) {
+        if (get_bit(item_has_value, i) || get_bit(item_has_config, i)) {
+            *fingerprint -= item_fingerprint(i, relocation);
+        } else {
+            *fingerprint -= layout->default_fingerprints[i];
+        }
+    };
+
+    // Config file values are written first, so argv overrides them
+    if (options.config) {
+        detail::StatsTimer timer(options.stats, &ParseStats::conversion);
+        if (!apply_config(*options.config, relocation, item_has_config, fingerprint, result.reason)) {
+            return fail(ParseError::Config, std::nullopt);
+        }
     }
 
     while (word_i < words.size()) {
-        std::string word = words[word_i];
+        std::string_view word = words[word_i];
         word_i++;
 
-        assert(!word.empty());
-        bool is_flag = (word[0] == '-' && (word[1] == '-' || !std::isdigit(word[1])));
+        bool is_flag = detail::is_flag_word(word);
 
         if (word == "-h" || word == "--help") {
-            std::cout << help_message(program) << std::endl;
-            return false;
+            return fail(ParseError::Help, word_i - 1);
         }
 
         std::size_t item_i;
         if (!is_flag) {
             if (arg_i == args.size()) {
                 if (!subcommands.empty()) {
-                    subcommand = std::find_if(
-                        subcommands.begin(), subcommands.end(),
-                        [&word](const Subcommand& value) {
-                            return value.name == word;
-                        }
-                    );
-                    if (subcommand == subcommands.end()) {
-                        std::cout << "Invalid subcommand '" << word << "'\n";
-                        return false;
+                    auto iter = subcommand_index.find(word);
+                    if (iter == subcommand_index.end()) {
+                        return fail(ParseError::InvalidSubcommand, word_i - 1);
                     }
+                    subcommand = subcommands.begin() + iter->second;
                     break;
                 }
-                std::cout << "Extra position argument '" << word << "'\n";
-                std::cout << "\n" << help_message(program) << std::endl;
-                return false;
+                return fail(ParseError::ExtraArgument, word_i - 1);
             }
             item_i = args[arg_i];
             arg_i++;
         } else {
-            auto iter = flags.find(word);
-            if (iter == flags.end()) {
-                std::cout << "Unknown flag '" << word << "'\n";
-                std::cout << "\n" << help_message(program) << std::endl;
-                return false;
+            std::optional<std::size_t> flag;
+            {
+                detail::StatsTimer timer(options.stats, &ParseStats::flag_lookup);
+                flag = find_flag(word);
             }
-            item_i = iter->second;
+            if (!flag.has_value()) {
+                return fail(ParseError::UnknownFlag, word_i - 1);
+            }
+            item_i = flag.value();
         }
 
         const Item& item = items[item_i];
-        item_has_value[item_i] = true;
+        if (fingerprint) {
+            unhash_value(item_i);
+        }
+        set_bit(item_has_value, item_i);
 
-        if (auto output = std::get_if<bool*>(&item.output)) {
+        if (item.kind == OutputKind::Flag) {
             assert(is_flag);
-            **output = true;
+            *static_cast<bool*>(relocation.apply(item.output)) = true;
+            if (fingerprint) {
+                *fingerprint += item_fingerprint(item_i, relocation);
+            }
             continue;
         }
 
         if (is_flag) {
             if (word_i == words.size()) {
-                std::cout << "Expected value after flag '" << word << "'\n";
-                std::cout << "\n" << help_message(program) << std::endl;
-                return false;
+                return fail(ParseError::MissingFlagValue, word_i - 1, &item);
             }
             word = words[word_i];
             word_i++;
         }
 
-        if (auto output = std::get_if<std::vector<std::string>*>(&item.output)) {
-            (*output)->clear();
-            (*output)->push_back(word);
+        if (is_list(item_i)) {
+            std::size_t list_begin = word_i - 1;
             while (word_i != words.size()) {
-                word = words[word_i];
-                if (is_flag && word[0] == '-') {
+                if (is_flag && detail::is_flag_word(words[word_i])) {
                     break;
                 }
-                (*output)->push_back(word);
                 word_i++;
             }
+            auto list = words.subspan(list_begin, word_i - list_begin);
+            detail::StatsTimer timer(options.stats, &ParseStats::conversion);
+            std::size_t converted = item.ops->assign_list(list, relocation.apply(item.output), *item.choices, result.reason, options.list_threads);
+            if (converted < list.size()) {
+                bool is_choice = item.choices->empty() || item.choices->find(list[converted]).has_value();
+                return fail(is_choice ? ParseError::InvalidValue : ParseError::InvalidChoice, list_begin + converted, &item);
+            }
         }
         else {
-            bool valid = std::visit([&](auto output) -> bool {
-                using T = std::decay_t<decltype(*output)>;
-                if constexpr(!std::is_same_v<T, bool> && !std::is_same_v<T, std::vector<std::string>>) {
-                    return parse_word(word, item.choices, *output);
-                }
-                assert(false);
-                return false;
-            }, item.output);
-            if (!valid) {
-                std::cout << "\n" << help_message(program) << std::endl;
+            detail::StatsTimer timer(options.stats, &ParseStats::conversion);
+            ParseError conversion = parse_value(item, word, relocation, result.reason);
+            if (conversion != ParseError::None) {
+                return fail(conversion, word_i - 1, &item);
+            }
+        }
+        if (fingerprint) {
+            *fingerprint += item_fingerprint(item_i, relocation);
+        }
+    }
+
+    if (layout) {
+        // Same fallbacks as below, but only visits items with an environment
+        // variable, and finds missing items a word of bits at a time
+        for (std::size_t i: layout->env_items) {
+            if (get_bit(item_has_value, i)) continue;
+            const Item& item = items[i];
+            auto value = Environment::get().find(item.env);
+            if (!value.has_value()) continue;
+            detail::StatsTimer timer(options.stats, &ParseStats::conversion);
+            if (fingerprint) {
+                unhash_value(i);
+            }
+            if (parse_value(item, value.value(), relocation, result.reason) != ParseError::None) {
+                fail(ParseError::InvalidEnvironmentValue, std::nullopt, &item);
+                result.word = value.value();
                 return false;
             }
+            if (fingerprint) {
+                *fingerprint += item_fingerprint(i, relocation);
+            }
+            set_bit(item_has_value, i);
+        }
+        for (std::size_t w = 0; w < item_has_value.size(); w++) {
+            std::uint64_t missing = ~(item_has_value[w] | item_has_config[w] | layout->has_default[w]);
+            if (w == item_has_value.size() - 1 && items.size() % 64 != 0) {
+                missing &= (std::uint64_t(1) << (items.size() % 64)) - 1;
+            }
+            if (missing != 0) {
+                const Item& item = items[w * 64 + std::countr_zero(missing)];
+                return fail(ParseError::MissingValue, std::nullopt, &item);
+            }
+        }
+    } else {
+        // Items not given in argv fall back to their environment variable, then
+        // the config file, then their default value
+        for (std::size_t i = 0; i < items.size(); i++) {
+            if (get_bit(item_has_value, i)) continue;
+            const Item& item = items[i];
+            if (!item.env.empty()) {
+                auto value = Environment::get().find(item.env);
+                if (value.has_value()) {
+                    detail::StatsTimer timer(options.stats, &ParseStats::conversion);
+                    if (parse_value(item, value.value(), relocation, result.reason) != ParseError::None) {
+                        fail(ParseError::InvalidEnvironmentValue, std::nullopt, &item);
+                        result.word = value.value();
+                        return false;
+                    }
+                    set_bit(item_has_value, i);
+                    continue;
+                }
+            }
+            if (get_bit(item_has_config, i)) continue;
+            if (item.has_default) continue;
+            return fail(ParseError::MissingValue, std::nullopt, &item);
         }
     }
 
-    for (std::size_t i = 0; i < items.size(); i++) {
-        if (item_has_value[i]) continue;
-        std::cout << "Missing value for '" << items[i].identifier << "'\n";
-        std::cout << "\n" << help_message(program) << std::endl;
-        return false;
+    if (fingerprint && subcommand != subcommands.end()) {
+        detail::FingerprintHasher hasher;
+        hasher.add(std::uint64_t(1));
+        hasher.add(command_path);
+        hasher.add(subcommand->name);
+        *fingerprint += hasher.finish();
     }
 
     if (subcommand != subcommands.end()) {
-        if (!subcommand->callback(program, words.subspan(word_i))) {
+        if (!subcommand->callback(program, words.subspan(word_i), options, result, relocation)) {
+            // The subcommand's word indices start after its name
+            if (result.word_index.has_value()) {
+                result.word_index.value() += word_i;
+            }
             return false;
         }
     } else if (subcommand_required) {
-        std::cout << "Missing subcommand\n";
-        return false;
+        return fail(ParseError::MissingSubcommand, std::nullopt);
     }
 
     return true;
 }
 
-std::string Parser::help_message(const std::string& program) const {
+Fingerprint Parser::item_fingerprint(std::size_t item_i, const Relocation& relocation) const {
+    const Item& item = items[item_i];
+    return value_fingerprint(item, layout->item_hashers[item_i], relocation.apply(item.output));
+}
+
+ParseError Parser::parse_value(
+    const Item& item,
+    std::string_view word,
+    const Relocation& relocation,
+    std::string& error) const
+{
+    assert(item.kind != OutputKind::List);
+    return item.ops->convert(word, *item.choices, relocation.apply(item.output), error);
+}
+
+bool Parser::apply_config(
+    const ConfigFile& config,
+    const Relocation& relocation,
+    std::span<std::uint64_t> item_has_config,
+    Fingerprint* fingerprint,
+    std::string& error) const
+{
+    // Sections select the subcommand the settings apply to, by the words
+    // which select it, eg: [remote add]
+    std::string_view section = command_path;
+    if (!section.empty()) {
+        section.remove_prefix(1);
+    }
+
+    auto config_error = [&](std::size_t line, const std::string& message) {
+        error = config.path() + ":" + std::to_string(line) + ": " + message;
+        return false;
+    };
+
+    // Keys are long flag names without the leading "--", prepended here in a
+    // fixed buffer so the flag lookup doesn't allocate
+    std::array<char, 256> flag;
+    flag[0] = '-';
+    flag[1] = '-';
+
+    ConfigFile::Cursor cursor;
+    while (auto setting = config.next(cursor)) {
+        if (!setting->valid) {
+            return config_error(setting->line, "Expected 'name = value'");
+        }
+        if (setting->section != section) continue;
+        if (setting->key.size() > flag.size() - 2) {
+            return config_error(setting->line, "Unknown setting '" + std::string(setting->key) + "'");
+        }
+        std::copy(setting->key.begin(), setting->key.end(), flag.begin() + 2);
+        auto item_i = find_flag(std::string_view(flag.data(), setting->key.size() + 2));
+        if (!item_i.has_value()) {
+            return config_error(setting->line, "Unknown setting '" + std::string(setting->key) + "'");
+        }
+        const Item& item = items[item_i.value()];
+        if (item.kind == OutputKind::List) {
+            return config_error(setting->line, "List '" + std::string(setting->key) + "' cannot be set from a config file");
+        }
+        // A setting given twice replaces the contribution of the first
+        bool given = (item_has_config[item_i.value() / 64] >> (item_i.value() % 64)) & 1;
+        if (fingerprint) {
+            *fingerprint -= given ? item_fingerprint(item_i.value(), relocation) : layout->default_fingerprints[item_i.value()];
+        }
+        std::string value_error;
+        ParseError conversion = parse_value(item, setting->value, relocation, value_error);
+        if (conversion == ParseError::InvalidChoice) {
+            value_error = detail::invalid_choice(setting->value, *item.choices);
+        }
+        if (conversion != ParseError::None) {
+            return config_error(setting->line, value_error);
+        }
+        if (fingerprint) {
+            *fingerprint += item_fingerprint(item_i.value(), relocation);
+        }
+        item_has_config[item_i.value() / 64] |= std::uint64_t(1) << (item_i.value() % 64);
+    }
+    return true;
+}
+
+std::optional<std::span<const char*>> Parser::argv_words(
+    int argc,
+    const char** argv,
+    const ParseOptions& options,
+    ParseResult& result) const
+{
+    if (argc >= 2 && std::string_view(argv[1]) == "__complete") {
+        complete_command(argc, argv, options);
+        result.error = ParseError::Completion;
+        return std::nullopt;
+    }
+    std::span<const char*> words(argv+1, argc-1);
+    if (!options.response_files) {
+        return words;
+    }
+    bool have_response_file = std::any_of(words.begin(), words.end(), [](const char* word) {
+        return word[0] == '@';
+    });
+    if (!have_response_file) {
+        return words;
+    }
+    if (!options.response_files->expand(argc, argv)) {
+        result.error = ParseError::ResponseFile;
+        result.reason = options.response_files->error();
+        return std::nullopt;
+    }
+    return std::span<const char*>(options.response_files->argv() + 1, options.response_files->argc() - 1);
+}
+
+std::string_view ParseResult::subcommand_path() const {
+    return parser ? std::string_view(parser->command_path) : std::string_view();
+}
+
+std::string ParseResult::message() const {
+    switch (error) {
+        case ParseError::None:
+        case ParseError::Help:
+        case ParseError::Completion:
+            return "";
+        case ParseError::ResponseFile:
+        case ParseError::Config:
+        case ParseError::InvalidValue:
+            return reason;
+        case ParseError::InvalidChoice:
+            return detail::invalid_choice(word, *item->choices);
+        case ParseError::UnknownFlag: {
+            Suggestions suggestions(word);
+            parser->for_each_flag([&](std::string_view key) {
+                suggestions.add(key);
+            });
+            return "Unknown flag '" + std::string(word) + "'" + suggestions.message();
+        }
+        case ParseError::MissingFlagValue:
+            return "Expected value after flag '" + std::string(word) + "'";
+        case ParseError::ExtraArgument:
+            return "Extra position argument '" + std::string(word) + "'";
+        case ParseError::InvalidSubcommand: {
+            Suggestions suggestions(word);
+            for (const auto& subcommand: parser->subcommands) {
+                suggestions.add(subcommand.name);
+            }
+            return "Invalid subcommand '" + std::string(word) + "'" + suggestions.message();
+        }
+        case ParseError::MissingSubcommand:
+            return "Missing subcommand";
+        case ParseError::InvalidEnvironmentValue:
+            // Invalid choices leave reason empty, as for InvalidChoice
+            if (reason.empty() && !item->choices->empty()) {
+                return detail::invalid_choice(word, *item->choices) + " (from environment variable '" + std::string(item->env) + "')";
+            }
+            return reason + " (from environment variable '" + std::string(item->env) + "')";
+        case ParseError::MissingValue:
+            return "Missing value for '" + std::string(item->identifier) + "'";
+    }
+    return "";
+}
+
+bool ParseResult::shows_help() const {
+    switch (error) {
+        case ParseError::Help:
+        case ParseError::UnknownFlag:
+        case ParseError::MissingFlagValue:
+        case ParseError::ExtraArgument:
+        case ParseError::InvalidValue:
+        case ParseError::InvalidChoice:
+        case ParseError::InvalidEnvironmentValue:
+        case ParseError::MissingValue:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void ParseResult::write(const Sink& output) const {
+    if (!parser || ok() || error == ParseError::Completion) {
+        return;
+    }
+    ParseOptions options;
+    options.output = output;
+    parser->write_message(program, message(), shows_help(), options);
+}
+
+void Parser::write_message(
+    std::string_view program,
+    const std::string& message,
+    bool show_help,
+    const ParseOptions& options) const
+{
+    const Sink& output = options.output ? options.output : stdout_sink;
+    if (!show_help) {
+        output(message + "\n");
+        return;
+    }
+    auto render = [&]() {
+        detail::StatsTimer timer(options.stats, &ParseStats::help_rendering);
+        return help_message(program);
+    };
+    help_cache.write(program, render, [&](const std::string& help) {
+        if (message.empty()) {
+            output(help);
+        } else {
+            output(message + "\n\n" + help);
+        }
+    });
+}
+
+std::string Parser::help_message(std::string_view program) const {
     std::stringstream ss;
-    ss << program;
+    ss << program << command_path;
     if (!description.empty()) {
         ss << " - " << description;
     }
     ss << "\n";
 
-    ss << "\033[1mUSAGE:\033[0m " << program;
+    ss << "\033[1mUSAGE:\033[0m " << program << command_path;
 
     // [optional args]
     // <required args>
@@ -243,15 +867,12 @@ std::string Parser::help_message(const std::string& program) const {
             return;
         }
         ss << "[" << item.identifier;
-        if (std::get_if<std::vector<std::string>*>(&item.output)) {
+        if (item.kind == OutputKind::List) {
             ss << "...";
-        } else {
-            std::visit([&](const auto& output) {
-                using T = std::decay_t<decltype(*output)>;
-                if constexpr(!is_optional_t<T>) {
-                    ss << " {" << *output << "}";
-                }
-            }, item.output);
+        } else if (item.ops->format) {
+            ss << " {";
+            item.ops->format(ss, item.output, *item.choices);
+            ss << "}";
         }
         ss << "]";
     };
@@ -260,8 +881,8 @@ std::string Parser::help_message(const std::string& program) const {
     bool have_optional_flag = false;
     bool have_arg = false;
     for (const auto& item: items) {
-        have_required_flag |= (item.type == ItemType::Flag && !item.is_optional);
-        have_required_flag |= (item.type == ItemType::Flag && item.is_optional);
+        have_required_flag |= (item.type == ItemType::Flag && !item.has_default);
+        have_optional_flag |= (item.type == ItemType::Flag && item.has_default);
         have_arg |= (item.type == ItemType::Arg);
     }
 
@@ -274,7 +895,7 @@ std::string Parser::help_message(const std::string& program) const {
             if (item.type != ItemType::Flag) continue;
             if (item.has_default) continue;
             print_item(item);
-            have_flag_help |= !item.help.empty() || !item.choices.empty();
+            have_flag_help |= !item.help.empty() || !item.choices->empty() || !item.env.empty();
         }
     }
     // Optional flags [--flag|-f] {default}
@@ -283,7 +904,7 @@ std::string Parser::help_message(const std::string& program) const {
             if (item.type != ItemType::Flag) continue;
             if (!item.has_default) continue;
             print_item(item);
-            have_flag_help |= !item.help.empty() || !item.choices.empty();
+            have_flag_help |= !item.help.empty() || !item.choices->empty() || !item.env.empty();
         }
     }
     // Args (note: guaranteed to have required args first)
@@ -291,7 +912,7 @@ std::string Parser::help_message(const std::string& program) const {
         for (const auto& item: items) {
             if (item.type != ItemType::Arg) continue;
             print_item(item);
-            have_arg_help |= !item.help.empty() || !item.choices.empty();
+            have_arg_help |= !item.help.empty() || !item.choices->empty() || !item.env.empty();
         }
     }
     // Subcommand
@@ -304,17 +925,22 @@ std::string Parser::help_message(const std::string& program) const {
     }
     ss << "\n";
 
-    auto print_help = [&ss](const std::string& help) {
+    auto print_help = [&ss](std::string_view help) {
         if (help.empty()) return;
         ss << "    " << help << "\n";
     };
 
-    auto print_choices = [&ss](const std::vector<std::string>& choices) {
+    auto print_env = [&ss](std::string_view env) {
+        if (env.empty()) return;
+        ss << "    Environment: " << env << "\n";
+    };
+
+    auto print_choices = [&ss](const Choices& choices) {
         if (choices.empty()) return;
         ss << "    Choices: [";
-        for (std::size_t i = 0; i < choices.size(); i++) {
-            ss << choices[i];
-            if (i+1 != choices.size()) {
+        for (std::size_t i = 0; i < choices.names.size(); i++) {
+            ss << choices.names[i];
+            if (i+1 != choices.names.size()) {
                 ss << ", ";
             }
         }
@@ -326,34 +952,37 @@ std::string Parser::help_message(const std::string& program) const {
         for (const auto& item: items) {
             if (item.type != ItemType::Flag) continue;
             if (item.has_default) continue;
-            if (item.help.empty() && item.choices.empty()) continue;
+            if (item.help.empty() && item.choices->empty() && item.env.empty()) continue;
             ss << "  ";
             print_item(item, false);
             ss << "\n";
             print_help(item.help);
-            print_choices(item.choices);
+            print_choices(*item.choices);
+            print_env(item.env);
         }
         for (const auto& item: items) {
             if (item.type != ItemType::Flag) continue;
             if (!item.has_default) continue;
-            if (item.help.empty() && item.choices.empty()) continue;
+            if (item.help.empty() && item.choices->empty() && item.env.empty()) continue;
             ss << "  ";
             print_item(item, false);
             ss << "\n";
             print_help(item.help);
-            print_choices(item.choices);
+            print_choices(*item.choices);
+            print_env(item.env);
         }
     }
     if (have_arg_help) {
         ss << "\n\033[1mARGUMENTS:\033[0m\n";
         for (const auto& item: items) {
             if (item.type != ItemType::Arg) continue;
-            if (item.help.empty() && item.choices.empty()) continue;
+            if (item.help.empty() && item.choices->empty() && item.env.empty()) continue;
             ss << "  ";
             print_item(item, false);
             ss << "\n";
             print_help(item.help);
-            print_choices(item.choices);
+            print_choices(*item.choices);
+            print_env(item.env);
         }
     }
     if (!subcommands.empty()) {
@@ -371,57 +1000,175 @@ std::string Parser::help_message(const std::string& program) const {
         }
     }
 
+    ss << "\n";
     return ss.str();
 }
 
-ItemType Parser::parse_identifier(const std::string& identifier) {
-    auto validate_word = [](const std::string& word) -> bool {
-        if (word.empty()) return false;
-        if (!std::isalpha(word[0])) return false;
-        for (char c: word) {
-            if (!std::isalnum(c) && c != '-' && c != '_') {
-                return false;
+void HelpCache::write(
+    std::string_view program,
+    const std::function<std::string()>& render,
+    const std::function<void(const std::string&)>& write) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!valid || program != this->program) {
+        this->program = program;
+        text = render();
+        valid = true;
+    }
+    write(text);
+}
+
+Environment::Environment() {
+    std::size_t size = 0;
+    for (char** entry = environ; *entry; entry++) {
+        size += std::strlen(*entry) + 1;
+    }
+    // Copied into one buffer, which must not reallocate once views are taken
+    data.reserve(size);
+    for (char** entry = environ; *entry; entry++) {
+        data.append(*entry);
+        data.push_back('\0');
+    }
+
+    std::size_t begin = 0;
+    while (begin < data.size()) {
+        std::string_view entry(data.c_str() + begin);
+        begin += entry.size() + 1;
+        std::size_t separator = entry.find('=');
+        if (separator == std::string_view::npos) continue;
+        // emplace keeps the first definition of a name, as getenv does
+        values.emplace(entry.substr(0, separator), entry.substr(separator + 1));
+    }
+}
+
+const Environment& Environment::get() {
+    static const Environment environment;
+    return environment;
+}
+
+std::optional<std::string_view> Environment::find(std::string_view name) const {
+    auto iter = values.find(name);
+    if (iter == values.end()) {
+        return std::nullopt;
+    }
+    return iter->second;
+}
+
+Sink fd_sink(int fd) {
+    return [fd](std::string_view text) {
+        while (!text.empty()) {
+            ssize_t written = ::write(fd, text.data(), text.size());
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return;
             }
+            text.remove_prefix(written);
         }
-        return true;
     };
+}
+
+Sink buffer_sink(std::string& buffer) {
+    return [&buffer](std::string_view text) {
+        buffer.append(text);
+    };
+}
+
+const Sink stdout_sink = [](std::string_view text) {
+    std::cout.write(text.data(), text.size());
+};
 
+ItemType Parser::parse_identifier(std::string_view identifier) {
     assert(!identifier.empty());
     if (identifier[0] != '-') {
-        if (!validate_word(identifier)) {
-            throw UsageError("Invalid identifier '" + identifier + "'");
+        if (!detail::validate_word(identifier)) {
+            throw UsageError("Invalid identifier '" + std::string(identifier) + "'");
         }
         args.push_back(items.size());
         return ItemType::Arg;
     }
 
-    std::size_t part_begin = 0;
-    while (part_begin != std::string::npos) {
-        std::size_t part_end = identifier.find('|', part_begin);
-        std::string part = identifier.substr(part_begin, part_end);
-        part_begin = part_end == std::string::npos ? std::string::npos : part_end + 1;
-
-        if (part == "-h" || part == "--help") {
-            throw UsageError("Cannot use flags '-h' and '--help', reserved for printing help message");
-        }
-        if (part.size() >= 2 && part[1] == '-') {
-            if (!validate_word(part.substr(2))) {
-                throw UsageError("Invalid flag '" + part + "'");
-            }
-        } else {
-            if (part.size() != 2 && !std::isalpha(part[1]))  {
-                throw UsageError("Invalid flag '" + part + "'");
+    // The identifier is in the arena, so its parts can be used as keys
+    detail::split_flags(identifier, [&](std::string_view part) {
+        if (const char* error = detail::validate_flag(part)) {
+            if (part == "-h" || part == "--help") {
+                throw UsageError(error);
             }
+            throw UsageError(std::string(error) + " '" + std::string(part) + "'");
         }
 
-        auto iter = flags.find(part);
-        if (iter != flags.end()) {
-            throw UsageError("Duplicate flag '" + part + "'");
+        if (!flags.emplace(part, items.size()).second) {
+            throw UsageError("Duplicate flag '" + std::string(part) + "'");
         }
-        flags.emplace(part, items.size());
-    }
+    });
 
     return ItemType::Flag;
 }
 
+ItemType Parser::schema_identifier(std::string_view identifier) {
+    std::size_t item_i = items.size();
+    if (item_i >= schema->identifiers.size() || schema->identifiers[item_i] != identifier) {
+        throw UsageError("Identifier '" + std::string(identifier) + "' does not match schema");
+    }
+    ItemType type = schema->types[item_i];
+    if (type == ItemType::Arg) {
+        args.push_back(item_i);
+    }
+    return type;
+}
+
+bool Parser::is_list(std::size_t item_i) const {
+    if (layout) {
+        return (layout->is_list[item_i / 64] >> (item_i % 64)) & 1;
+    }
+    return items[item_i].kind == OutputKind::List;
+}
+
+std::optional<std::size_t> Parser::find_flag(std::string_view word) const {
+    if (layout) {
+        return layout->flags.find(word);
+    }
+    if (schema) {
+        return schema->flags.find(word);
+    }
+    auto iter = flags.find(word);
+    if (iter == flags.end()) {
+        return std::nullopt;
+    }
+    return iter->second;
+}
+
 } // namespace argparse
+
+namespace argparse::detail {
+
+// Perfect hashes must build for any small key set, where two keys are most
+// likely to share a slot. Checked when the library is compiled, over random
+// sets of 2 to 11 keys.
+constexpr bool small_perfect_hashes_build() {
+    std::uint64_t state = 0x853c49e6748fea9bull;
+    auto next = [&]() {
+        // splitmix64
+        state += 0x9e3779b97f4a7c15ull;
+        std::uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    };
+    for (std::size_t set = 0; set < 500; set++) {
+        std::size_t num_keys = 2 + set % 10;
+        std::vector<std::uint64_t> hashes(num_keys);
+        for (auto& hash: hashes) {
+            hash = next();
+        }
+        std::vector<std::uint32_t> displacements(perfect_hash_buckets(num_keys));
+        std::vector<std::uint32_t> slots(perfect_hash_slots(num_keys));
+        if (!build_perfect_hash(hashes, displacements, slots)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(small_perfect_hashes_build(), "Failed to build a perfect hash for a small key set");
+
+} // namespace argparse::detail
@@ -0,0 +1,206 @@
+#include "argparse.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace argparse {
+
+static void append_json_string(std::string& out, std::string_view text) {
+    static constexpr char hex[] = "0123456789abcdef";
+    out += '"';
+    for (char c: text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += hex[(c >> 4) & 0xf];
+                    out += hex[c & 0xf];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// Writes all of text, without raising SIGPIPE if out is a closed socket
+static bool write_all(int out, std::string_view text) {
+    while (!text.empty()) {
+        ssize_t written = send(out, text.data(), text.size(), MSG_NOSIGNAL);
+        if (written < 0 && errno == ENOTSOCK) {
+            written = write(out, text.data(), text.size());
+        }
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        text.remove_prefix(written);
+    }
+    return true;
+}
+
+static void append_reply(std::string& reply, std::optional<int> status, std::string_view output) {
+    reply += "{\"ok\": ";
+    reply += status.has_value() ? "true" : "false";
+    reply += ", \"status\": ";
+    reply += status.has_value() ? std::to_string(status.value()) : "null";
+    reply += ", \"output\": ";
+    append_json_string(reply, output);
+    reply += "}\n";
+}
+
+CommandServer::CommandServer(const std::string& program, command_t command):
+    program(program),
+    command(std::move(command)),
+    sink(buffer_sink(output))
+{}
+
+void CommandServer::run(std::string_view text, std::string& reply) {
+    // tokenize() needs a writable byte after the text
+    line.assign(text);
+    line.push_back('\0');
+    words.clear();
+    words.push_back(program.c_str());
+    bool ok = tokenize(line.data(), text.size(), words);
+    if (ok && words.size() == 1) {
+        return;
+    }
+
+    output.clear();
+    std::optional<int> status;
+    if (!ok) {
+        output = "Unterminated quote\n";
+    } else {
+        status = command(words.size(), words.data(), sink);
+    }
+    append_reply(reply, status, output);
+}
+
+bool CommandServer::serve(int in, int out) {
+    std::string pending;
+    std::string replies;
+    char buffer[65536];
+    while (true) {
+        ssize_t size = read(in, buffer, sizeof(buffer));
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                error_message = "Timed out reading commands";
+                return false;
+            }
+            error_message = "Failed to read commands: " + std::string(std::strerror(errno));
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+        pending.append(buffer, size);
+
+        std::size_t begin = 0;
+        while (true) {
+            std::size_t end = pending.find('\n', begin);
+            if (end == std::string::npos) break;
+            run(std::string_view(pending).substr(begin, end - begin), replies);
+            begin = end + 1;
+        }
+        pending.erase(0, begin);
+        bool too_long = pending.size() > max_line_size;
+        if (too_long) {
+            append_reply(replies, std::nullopt, "Line too long\n");
+        }
+        if (!write_all(out, replies)) {
+            error_message = "Failed to write replies: " + std::string(std::strerror(errno));
+            return false;
+        }
+        if (too_long) {
+            error_message = "Line too long";
+            return false;
+        }
+        replies.clear();
+    }
+
+    // Final line without a newline
+    run(pending, replies);
+    if (!write_all(out, replies)) {
+        error_message = "Failed to write replies: " + std::string(std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool CommandServer::listen(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        error_message = "Socket path '" + path + "' is too long";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0) {
+        error_message = "Failed to create socket: " + std::string(std::strerror(errno));
+        return false;
+    }
+    // A socket left by a server which didn't exit cleanly would fail bind().
+    // It is only removed if nothing accepts connections on it; a live
+    // server's socket, or anything else at path, is kept
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            error_message = "Failed to create socket: " + std::string(std::strerror(errno));
+            close(server);
+            return false;
+        }
+        bool stale = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            && errno == ECONNREFUSED;
+        close(probe);
+        if (!stale) {
+            error_message = "Socket path '" + path + "' is already in use";
+            close(server);
+            return false;
+        }
+        unlink(path.c_str());
+    }
+    if (bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        error_message = "Failed to listen on '" + path + "': " + std::string(std::strerror(errno));
+        close(server);
+        return false;
+    }
+    if (::listen(server, SOMAXCONN) != 0) {
+        error_message = "Failed to listen on '" + path + "': " + std::string(std::strerror(errno));
+        close(server);
+        unlink(path.c_str());
+        return false;
+    }
+
+    timeval timeout = {};
+    timeout.tv_sec = connection_timeout.count() / 1000;
+    timeout.tv_usec = (connection_timeout.count() % 1000) * 1000;
+    while (true) {
+        int connection = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            error_message = "Failed to accept connection: " + std::string(std::strerror(errno));
+            close(server);
+            unlink(path.c_str());
+            return false;
+        }
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        // A failed connection only ends that connection
+        serve(connection, connection);
+        close(connection);
+    }
+}
+
+} // namespace argparse
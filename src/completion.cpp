@@ -0,0 +1,244 @@
+#include "argparse.hpp"
+
+namespace argparse {
+
+namespace {
+
+// Prefix trie over completion candidates. Nodes are stored in one vector and
+// the edges of each node in a contiguous, sorted range of another, so that
+// finding the node for a prefix is one binary search per character, and the
+// candidates beneath it come out in sorted order.
+class CompletionTrie {
+public:
+    explicit CompletionTrie(std::vector<std::string_view> tokens):
+        tokens(std::move(tokens))
+    {
+        std::sort(this->tokens.begin(), this->tokens.end());
+        this->tokens.erase(std::unique(this->tokens.begin(), this->tokens.end()), this->tokens.end());
+        nodes.emplace_back();
+        build(0, 0, this->tokens.size(), 0);
+    }
+
+    // Appends each candidate starting with prefix to output, one per line
+    void complete(std::string_view prefix, std::string& output) const {
+        std::uint32_t node = 0;
+        for (char c: prefix) {
+            auto begin = edges.begin() + nodes[node].edges_begin;
+            auto end = edges.begin() + nodes[node].edges_end;
+            auto edge = std::lower_bound(begin, end, c, [](const Edge& edge, char c) {
+                return edge.c < c;
+            });
+            if (edge == end || edge->c != c) {
+                return;
+            }
+            node = edge->node;
+        }
+        collect(node, output);
+    }
+
+private:
+    static constexpr std::uint32_t no_token = 0xffffffff;
+
+    struct Node {
+        std::uint32_t edges_begin = 0;
+        std::uint32_t edges_end = 0;
+        std::uint32_t token = no_token;
+    };
+    struct Edge {
+        char c;
+        std::uint32_t node;
+    };
+
+    // Builds the subtree of node from the sorted tokens [begin, end), which
+    // share their first depth characters
+    void build(std::uint32_t node, std::size_t begin, std::size_t end, std::size_t depth) {
+        if (begin != end && tokens[begin].size() == depth) {
+            nodes[node].token = begin;
+            begin++;
+        }
+        // Add all edges of the node before recursing, so they are contiguous
+        std::size_t edges_begin = edges.size();
+        for (std::size_t i = begin; i < end; i++) {
+            if (i == begin || tokens[i][depth] != tokens[i - 1][depth]) {
+                edges.push_back({ tokens[i][depth], std::uint32_t(nodes.size()) });
+                nodes.emplace_back();
+            }
+        }
+        std::size_t edges_end = edges.size();
+        nodes[node].edges_begin = edges_begin;
+        nodes[node].edges_end = edges_end;
+        std::size_t group_begin = begin;
+        for (std::size_t e = edges_begin; e < edges_end; e++) {
+            std::size_t group_end = group_begin;
+            while (group_end < end && tokens[group_end][depth] == edges[e].c) {
+                group_end++;
+            }
+            build(edges[e].node, group_begin, group_end, depth + 1);
+            group_begin = group_end;
+        }
+    }
+
+    void collect(std::uint32_t node, std::string& output) const {
+        if (nodes[node].token != no_token) {
+            output += tokens[nodes[node].token];
+            output += '\n';
+        }
+        for (std::uint32_t e = nodes[node].edges_begin; e < nodes[node].edges_end; e++) {
+            collect(edges[e].node, output);
+        }
+    }
+
+    std::vector<std::string_view> tokens;
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+};
+
+void complete_choices(const Choices& choices, std::string_view partial, std::string& output) {
+    std::vector<std::string_view> tokens(choices.names.begin(), choices.names.end());
+    CompletionTrie(std::move(tokens)).complete(partial, output);
+}
+
+// Shell function names can't contain every character a program name can
+std::string function_name(std::string_view program) {
+    std::string name = "_";
+    for (char c: program) {
+        name += detail::is_alnum(c) ? c : '_';
+    }
+    return name + "_complete";
+}
+
+std::optional<std::string> completion_script(std::string_view shell, std::string_view program) {
+    std::string name(program);
+    std::string function = function_name(program);
+    if (shell == "bash") {
+        return
+            function + "() {\n"
+            "    local IFS=$'\\n'\n"
+            "    COMPREPLY=($(\"${COMP_WORDS[0]}\" __complete -- \"${COMP_WORDS[@]:1:COMP_CWORD}\" 2>/dev/null))\n"
+            "}\n"
+            "complete -o default -F " + function + " " + name + "\n";
+    }
+    if (shell == "zsh") {
+        return
+            "#compdef " + name + "\n" +
+            function + "() {\n"
+            "    local -a candidates\n"
+            "    candidates=(${(f)\"$(\"${words[1]}\" __complete -- \"${(@)words[2,CURRENT]}\" 2>/dev/null)\"})\n"
+            "    compadd -- $candidates\n"
+            "}\n"
+            "if [ \"$funcstack[1]\" = \"" + function + "\" ]; then\n"
+            "    " + function + " \"$@\"\n"
+            "else\n"
+            "    compdef " + function + " " + name + "\n"
+            "fi\n";
+    }
+    if (shell == "fish") {
+        return
+            "complete -c " + name + " -f -a '(" + name +
+            " __complete -- (commandline -opc)[2..-1] (commandline -ct) 2>/dev/null)'\n";
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+void Parser::complete_command(int argc, const char** argv, const ParseOptions& options) const {
+    const Sink& output = options.output ? options.output : stdout_sink;
+    std::span<const char*> words(argv + 2, argc - 2);
+
+    if (words.size() == 1 && std::string_view(words[0]) != "--") {
+        std::string_view program = argv[0];
+        program = program.substr(program.rfind('/') + 1);
+        auto script = completion_script(words[0], program);
+        if (!script.has_value()) {
+            output("Unknown shell '" + std::string(words[0]) + "', expected bash, zsh or fish\n");
+            return;
+        }
+        output(script.value());
+        return;
+    }
+    if (words.empty() || std::string_view(words[0]) != "--") {
+        output("Expected '__complete bash|zsh|fish' or '__complete -- <words>'\n");
+        return;
+    }
+
+    std::string candidates;
+    complete(words.subspan(1), candidates);
+    output(candidates);
+}
+
+void Parser::complete(std::span<const char*> words, std::string& output) const {
+    // The final word is the one being completed
+    std::string_view partial = words.empty() ? "" : words.back();
+    std::size_t num_complete = words.empty() ? 0 : words.size() - 1;
+
+    // Follows the words the same way parse() would, without converting any
+    // values, to find what the partial word could be
+    std::size_t arg_i = 0;
+    std::optional<std::size_t> pending; // Flag whose value comes next
+    for (std::size_t word_i = 0; word_i < num_complete; word_i++) {
+        std::string_view word = words[word_i];
+        bool is_flag = detail::is_flag_word(word);
+        if (pending.has_value()) {
+            if (!is_list(pending.value())) {
+                pending.reset();
+                continue;
+            }
+            if (!is_flag) {
+                continue;
+            }
+            pending.reset();
+        }
+        if (is_flag) {
+            auto flag = find_flag(word);
+            if (flag.has_value() && items[flag.value()].kind != OutputKind::Flag) {
+                pending = flag;
+            }
+            continue;
+        }
+        if (arg_i < args.size()) {
+            if (!is_list(args[arg_i])) {
+                arg_i++;
+            }
+            continue;
+        }
+        auto iter = subcommand_index.find(word);
+        if (iter == subcommand_index.end()) {
+            return;
+        }
+        subcommands[iter->second].parser().complete(words.subspan(word_i + 1), output);
+        return;
+    }
+
+    if (pending.has_value()) {
+        complete_choices(*items[pending.value()].choices, partial, output);
+        return;
+    }
+    // A lone "-" is a value in argv, but as a partial word it starts a flag
+    if (!detail::is_flag_word(partial) && partial != "-") {
+        if (arg_i < args.size()) {
+            complete_choices(*items[args[arg_i]].choices, partial, output);
+            return;
+        }
+        if (!subcommands.empty()) {
+            std::vector<std::string_view> tokens;
+            tokens.reserve(subcommands.size());
+            for (const auto& subcommand: subcommands) {
+                tokens.push_back(subcommand.name);
+            }
+            CompletionTrie(std::move(tokens)).complete(partial, output);
+            return;
+        }
+        if (!partial.empty()) {
+            return;
+        }
+    }
+
+    std::vector<std::string_view> tokens = { "-h", "--help" };
+    for_each_flag([&](std::string_view name) {
+        tokens.push_back(name);
+    });
+    CompletionTrie(std::move(tokens)).complete(partial, output);
+}
+
+} // namespace argparse
@@ -0,0 +1,120 @@
+#include "argparse.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace argparse {
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static std::string_view trim(std::string_view text) {
+    while (!text.empty() && is_blank(text.front())) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && is_blank(text.back())) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+ConfigFile::~ConfigFile() {
+    close();
+}
+
+void ConfigFile::close() {
+    if (data && size > 0 && contents.empty()) {
+        munmap(const_cast<char*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    contents.clear();
+}
+
+bool ConfigFile::open(const std::string& path) {
+    close();
+    file_path = path;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error_message = "Failed to open config file '" + path + "'";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        error_message = "Failed to read config file '" + path + "'";
+        ::close(fd);
+        return false;
+    }
+    if (!S_ISREG(info.st_mode)) {
+        bool read = detail::read_all(fd, contents);
+        ::close(fd);
+        if (!read) {
+            contents.clear();
+            error_message = "Failed to read config file '" + path + "'";
+            return false;
+        }
+        data = contents.data();
+        size = contents.size();
+        return true;
+    }
+    if (info.st_size == 0) {
+        ::close(fd);
+        data = "";
+        return true;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        error_message = "Failed to map config file '" + path + "'";
+        return false;
+    }
+    data = static_cast<const char*>(mapping);
+    size = info.st_size;
+    return true;
+}
+
+std::optional<ConfigFile::Setting> ConfigFile::next(Cursor& cursor) const {
+    while (cursor.position < size) {
+        std::string_view rest(data + cursor.position, size - cursor.position);
+        std::size_t line_end = rest.find('\n');
+        std::string_view line = rest.substr(0, line_end);
+        cursor.position += line_end == std::string_view::npos ? rest.size() : line_end + 1;
+        cursor.line++;
+
+        line = trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+
+        Setting setting;
+        setting.line = cursor.line;
+        setting.valid = false;
+
+        if (line[0] == '[') {
+            if (line.back() != ']') {
+                return setting;
+            }
+            cursor.section = trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+
+        std::size_t separator = line.find('=');
+        if (separator == std::string_view::npos) {
+            return setting;
+        }
+        setting.section = cursor.section;
+        setting.key = trim(line.substr(0, separator));
+        setting.value = trim(line.substr(separator + 1));
+        if (setting.value.size() >= 2 && setting.value.front() == '"' && setting.value.back() == '"') {
+            setting.value = setting.value.substr(1, setting.value.size() - 2);
+        }
+        setting.valid = !setting.key.empty();
+        return setting;
+    }
+    return std::nullopt;
+}
+
+} // namespace argparse
@@ -0,0 +1,53 @@
+#include "argparse.hpp"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace argparse {
+
+bool detail::read_elements(
+    int fd,
+    char separator,
+    const std::function<bool(std::string_view)>& callback,
+    std::string& error)
+{
+    constexpr std::size_t buffer_size = 65536;
+    auto buffer = std::make_unique<char[]>(buffer_size);
+    // Element continuing past the end of the last read
+    std::string partial;
+    while (true) {
+        ssize_t size = read(fd, buffer.get(), buffer_size);
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            error = "Failed to read input: " + std::string(std::strerror(errno));
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+        std::string_view chunk(buffer.get(), size);
+        while (true) {
+            std::size_t end = chunk.find(separator);
+            if (end == std::string_view::npos) {
+                partial.append(chunk);
+                break;
+            }
+            std::string_view element = chunk.substr(0, end);
+            chunk.remove_prefix(end + 1);
+            if (!partial.empty()) {
+                partial.append(element);
+                element = partial;
+            }
+            if (!element.empty() && !callback(element)) {
+                return true;
+            }
+            partial.clear();
+        }
+    }
+    if (!partial.empty()) {
+        callback(partial);
+    }
+    return true;
+}
+
+} // namespace argparse
@@ -0,0 +1,153 @@
+#include "argparse.hpp"
+#include <bit>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace argparse {
+
+#if defined(__SSE2__)
+
+// Converts the digits in the first size bytes of chunk, 1 to 15 of them, or
+// returns false if any aren't digits. The digits are shifted to the end of
+// the register, then adjacent digits are combined with multiply-adds: pairs,
+// then groups of four, then two groups of eight which are joined in scalar
+// code.
+static bool parse_digits(__m128i chunk, std::size_t size, std::uint64_t& value) {
+    const __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i in_word = _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(size)), index);
+    __m128i digits = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+    __m128i invalid = _mm_or_si128(
+        _mm_cmplt_epi8(digits, _mm_setzero_si128()),
+        _mm_cmpgt_epi8(digits, _mm_set1_epi8(9)));
+    if (_mm_movemask_epi8(_mm_and_si128(invalid, in_word)) != 0) {
+        return false;
+    }
+    digits = _mm_and_si128(digits, in_word);
+
+    // Shift left by the unused bytes, which become leading zeros
+    int bits = static_cast<int>(16 - size) * 8;
+    __m128i low_to_high = _mm_slli_si128(digits, 8);
+    if (bits < 64) {
+        digits = _mm_or_si128(
+            _mm_sll_epi64(digits, _mm_cvtsi32_si128(bits)),
+            _mm_srl_epi64(low_to_high, _mm_cvtsi32_si128(64 - bits)));
+    } else {
+        digits = _mm_sll_epi64(low_to_high, _mm_cvtsi32_si128(bits - 64));
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i tens = _mm_setr_epi16(10, 1, 10, 1, 10, 1, 10, 1);
+    __m128i pairs = _mm_packs_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), tens),
+        _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), tens));
+    __m128i fours = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    fours = _mm_packs_epi32(fours, fours);
+    __m128i eights = _mm_madd_epi16(fours, _mm_setr_epi16(10000, 1, 10000, 1, 0, 0, 0, 0));
+
+    std::uint64_t high = static_cast<std::uint32_t>(_mm_cvtsi128_si32(eights));
+    std::uint64_t low = static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(eights, 4)));
+    value = high * 100000000 + low;
+    return true;
+}
+
+// Loads the 16 bytes from word, which may extend past its terminator, and
+// finds its length. Loads which would cross into the next page, where they
+// could fault, copy the word instead. Sanitizers would report the bytes
+// read past the terminator, so they always copy.
+static bool load_word(const char* word, __m128i& chunk, std::size_t& size) {
+    constexpr std::uintptr_t page_size = 4096;
+#if defined(__SANITIZE_ADDRESS__)
+    constexpr bool may_overread = false;
+#else
+    constexpr bool may_overread = true;
+#endif
+    if (may_overread && (reinterpret_cast<std::uintptr_t>(word) % page_size) <= page_size - 16) {
+        chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word));
+        int terminators = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128()));
+        if (terminators == 0) {
+            return false;
+        }
+        size = std::countr_zero(static_cast<unsigned>(terminators));
+        return true;
+    }
+    size = std::strlen(word);
+    if (size >= 16) {
+        return false;
+    }
+    alignas(16) char buffer[16] = {};
+    std::memcpy(buffer, word, size);
+    chunk = _mm_load_si128(reinterpret_cast<const __m128i*>(buffer));
+    return true;
+}
+
+// Converts words which are an optional sign and up to 15 digits, in range
+// for T. Returns false for anything else, which is left to value_parser so
+// that the errors are the same as for a single value.
+template <typename T>
+static bool parse_integer(const char* word, T& output) {
+    bool negative = false;
+    if (word[0] == '-' || word[0] == '+') {
+        negative = word[0] == '-';
+        word++;
+    }
+    __m128i chunk;
+    std::size_t size;
+    if (!load_word(word, chunk, size) || size == 0) {
+        return false;
+    }
+    std::uint64_t value;
+    if (!parse_digits(chunk, size, value)) {
+        return false;
+    }
+    if (negative) {
+        if constexpr(std::is_signed_v<T>) {
+            // Unsigned arithmetic, as -min doesn't fit in T
+            if (value > std::uint64_t(std::numeric_limits<T>::max()) + 1) {
+                return false;
+            }
+            output = static_cast<T>(-static_cast<std::int64_t>(value));
+            return true;
+        } else {
+            return false;
+        }
+    }
+    if (value > std::uint64_t(std::numeric_limits<T>::max())) {
+        return false;
+    }
+    output = static_cast<T>(value);
+    return true;
+}
+
+#endif
+
+template <is_number_t T>
+std::size_t detail::parse_numbers(std::span<const char*> words, T* output, std::string& error) {
+    for (std::size_t i = 0; i < words.size(); i++) {
+#if defined(__SSE2__)
+        if constexpr(std::is_integral_v<T>) {
+            if (parse_integer(words[i], output[i])) {
+                continue;
+            }
+        }
+#endif
+        if (!value_parser<T>::parse(words[i], output[i], error)) {
+            return i;
+        }
+    }
+    return words.size();
+}
+
+template std::size_t detail::parse_numbers(std::span<const char*>, int*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, long*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, long long*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, unsigned int*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, unsigned long*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, unsigned long long*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, float*, std::string&);
+template std::size_t detail::parse_numbers(std::span<const char*>, double*, std::string&);
+
+} // namespace argparse
@@ -0,0 +1,59 @@
+#include "argparse.hpp"
+#include <thread>
+
+namespace argparse {
+
+std::size_t detail::convert_chunks(
+    std::size_t size,
+    unsigned threads,
+    const std::function<std::size_t(std::size_t begin, std::size_t end, std::string& error)>& convert,
+    std::string& error)
+{
+    if (threads <= 1 || size < parallel_list_min_words) {
+        return convert(0, size, error);
+    }
+
+    // Each chunk has its own error, and the calling thread converts the first
+    std::size_t num_chunks = std::min<std::size_t>(threads, size / (parallel_list_min_words / 4));
+    std::vector<std::string> errors(num_chunks);
+    std::vector<std::size_t> converted(num_chunks);
+    auto chunk_begin = [&](std::size_t chunk_i) {
+        return size * chunk_i / num_chunks;
+    };
+    auto run = [&](std::size_t chunk_i) {
+        converted[chunk_i] = convert(chunk_begin(chunk_i), chunk_begin(chunk_i + 1), errors[chunk_i]);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(num_chunks - 1);
+    for (std::size_t chunk_i = 1; chunk_i < num_chunks; chunk_i++) {
+        workers.emplace_back(run, chunk_i);
+    }
+    run(0);
+    for (auto& worker: workers) {
+        worker.join();
+    }
+
+    for (std::size_t chunk_i = 0; chunk_i < num_chunks; chunk_i++) {
+        std::size_t begin = chunk_begin(chunk_i);
+        if (converted[chunk_i] < chunk_begin(chunk_i + 1) - begin) {
+            error = std::move(errors[chunk_i]);
+            return begin + converted[chunk_i];
+        }
+    }
+    return size;
+}
+
+std::size_t detail::count_choices(std::span<const char*> words, const Choices& choices, unsigned threads) {
+    std::string unused;
+    return convert_chunks(words.size(), threads, [&](std::size_t begin, std::size_t end, std::string&) {
+        for (std::size_t i = begin; i < end; i++) {
+            if (!choices.find(words[i]).has_value()) {
+                return i - begin;
+            }
+        }
+        return end - begin;
+    }, unused);
+}
+
+} // namespace argparse
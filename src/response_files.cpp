@@ -0,0 +1,210 @@
+#include "argparse.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace argparse {
+
+static constexpr std::size_t max_response_file_depth = 32;
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool tokenize(char* text, std::size_t size, std::vector<const char*>& words) {
+    const char* in = text;
+    const char* end = text + size;
+    char* out = text;
+
+    while (true) {
+        while (in != end && is_space(*in)) {
+            in++;
+        }
+        if (in == end) {
+            return true;
+        }
+        if (*in == '#') {
+            while (in != end && *in != '\n') {
+                in++;
+            }
+            continue;
+        }
+
+        // Unquoting only ever shrinks a word, so it can be written in place
+        char* word = out;
+        while (in != end && !is_space(*in)) {
+            if (*in == '\'') {
+                in++;
+                while (in != end && *in != '\'') {
+                    *out++ = *in++;
+                }
+                if (in == end) {
+                    return false;
+                }
+                in++;
+            } else if (*in == '"') {
+                in++;
+                while (in != end && *in != '"') {
+                    if (*in == '\\' && in + 1 != end && (in[1] == '"' || in[1] == '\\' || in[1] == '$' || in[1] == '`')) {
+                        in++;
+                    } else if (*in == '\\' && in + 1 != end && in[1] == '\n') {
+                        in += 2;
+                        continue;
+                    }
+                    *out++ = *in++;
+                }
+                if (in == end) {
+                    return false;
+                }
+                in++;
+            } else if (*in == '\\') {
+                in++;
+                if (in == end) {
+                    return false;
+                }
+                if (*in == '\n') {
+                    in++;
+                    continue;
+                }
+                *out++ = *in++;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        // Consume the separator first, since the terminator may overwrite it.
+        // out <= in, and text[size] is writable, so this never overwrites
+        // unread input.
+        if (in != end) {
+            in++;
+        }
+        *out++ = '\0';
+        words.push_back(word);
+    }
+}
+
+ResponseFiles::~ResponseFiles() {
+    unmap();
+}
+
+void ResponseFiles::unmap() {
+    for (const auto& mapping: mappings) {
+        munmap(mapping.data, mapping.size);
+    }
+    mappings.clear();
+}
+
+// Reads all of a file which can't be mapped, such as a pipe
+bool detail::read_all(int fd, std::string& contents) {
+    char buffer[65536];
+    while (true) {
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (size == 0) {
+            return true;
+        }
+        contents.append(buffer, size);
+    }
+}
+
+bool ResponseFiles::expand(int argc, const char** argv) {
+    // The words of the files from the previous call are no longer needed
+    unmap();
+    words.clear();
+    words.push_back(argv[0]);
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> open_files;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '@') {
+            words.push_back(argv[i]);
+            continue;
+        }
+        if (!expand_file(argv[i] + 1, open_files)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ResponseFiles::expand_file(
+    const char* path,
+    std::vector<std::pair<std::uint64_t, std::uint64_t>>& open_files)
+{
+    if (open_files.size() == max_response_file_depth) {
+        error_message = "Response files nested too deeply at '" + std::string(path) + "'";
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error_message = "Failed to open response file '" + std::string(path) + "'";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        error_message = "Failed to read response file '" + std::string(path) + "'";
+        close(fd);
+        return false;
+    }
+
+    std::pair<std::uint64_t, std::uint64_t> file_id(info.st_dev, info.st_ino);
+    if (std::find(open_files.begin(), open_files.end(), file_id) != open_files.end()) {
+        error_message = "Response file '" + std::string(path) + "' includes itself";
+        close(fd);
+        return false;
+    }
+
+    // Pipes, FIFOs and the like have no size, so are read and copied
+    bool is_regular = S_ISREG(info.st_mode);
+    std::string contents;
+    if (!is_regular && !detail::read_all(fd, contents)) {
+        error_message = "Failed to read response file '" + std::string(path) + "'";
+        close(fd);
+        return false;
+    }
+
+    // Reserve one byte more than the file, so the final word can be NUL
+    // terminated, then map the file privately over the start of it. Writes
+    // from tokenizing go to private copies of the pages, not the file.
+    std::size_t size = is_regular ? info.st_size : contents.size();
+    void* data = mmap(nullptr, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        error_message = "Failed to map response file '" + std::string(path) + "'";
+        close(fd);
+        return false;
+    }
+    mappings.push_back(Mapping{ data, size + 1 });
+    if (!is_regular) {
+        std::memcpy(data, contents.data(), size);
+    } else if (size > 0 && mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        error_message = "Failed to map response file '" + std::string(path) + "'";
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    std::vector<const char*> file_words;
+    if (!tokenize(static_cast<char*>(data), size, file_words)) {
+        error_message = "Unterminated quote in response file '" + std::string(path) + "'";
+        return false;
+    }
+
+    open_files.push_back(file_id);
+    for (const char* word: file_words) {
+        if (word[0] != '@') {
+            words.push_back(word);
+            continue;
+        }
+        if (!expand_file(word + 1, open_files)) {
+            return false;
+        }
+    }
+    open_files.pop_back();
+    return true;
+}
+
+} // namespace argparse